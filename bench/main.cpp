@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../imgui_lua_inspector.hpp"
+#include "imgui.h"
+
+// Headless benchmark: no window, no renderer backend. Every frame is NewFrame -> luainspector_draw -> Render,
+// the draw data is thrown away. Prints one JSON object per line per (workload, tab). With --check-alloc it exits
+// non-zero when any tab still allocates (operator new, ImGui or Lua) once its walks have settled.
+
+static std::atomic<std::size_t> g_new_count{0};
+static std::size_t g_lua_count = 0;
+static std::size_t g_imgui_count = 0;
+
+void* operator new(std::size_t size) {
+    g_new_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, std::size_t) noexcept { free(p); }
+
+static void* bench_lua_alloc(void*, void* ptr, size_t osize, size_t nsize) {
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!ptr || nsize > osize) ++g_lua_count;
+    return realloc(ptr, nsize);
+}
+
+static void* bench_imgui_alloc(size_t size, void*) {
+    ++g_imgui_count;
+    return malloc(size);
+}
+static void bench_imgui_free(void* ptr, void*) { free(ptr); }
+
+static int bench_make_userdata(lua_State* L) {
+    lua_Integer n = luaL_checkinteger(L, 1);
+    lua_createtable(L, (int)n, 0);
+    luaL_newmetatable(L, "bench_object");
+    lua_pop(L, 1);
+    for (lua_Integer i = 1; i <= n; ++i) {
+        lua_Integer* p = (lua_Integer*)lua_newuserdata(L, sizeof(lua_Integer));
+        *p = i;
+        luaL_setmetatable(L, "bench_object");
+        lua_rawseti(L, -2, i);
+    }
+    return 1;
+}
+
+struct bench_workload {
+    const char* name;
+    const char* script;
+    int log_lines;
+};
+
+static const bench_workload s_workloads[] = {
+        {"wide_globals", "for i = 1, 50000 do _G['g' .. i] = i end", 0},
+        {"deep_nesting", "local t = {} deep = t for i = 1, 200 do t.next = {depth = i} t = t.next end", 0},
+        {"huge_strings", "huge = {} for i = 1, 4 do huge[i] = string.rep('x', 10 * 1024 * 1024) end", 0},
+        {"large_array", "arr = {} for i = 1, 1000000 do arr[i] = i end", 0},
+        {"many_userdata", "objects = __bench_make_userdata(100000)", 0},
+        {"long_log", "", 100000},
+};
+
+static const char* s_tabs[] = {"Console", "Registry", "Tables", "Watch", "Memory", "Profiler", "Info"};
+
+struct bench_options {
+    int frames = 300;
+    int warmup = 600;  // upper bound on frames spent letting budgeted walks finish
+    int depth = 3;
+    const char* only = nullptr;
+    bool check_alloc = false;
+    bool check_sort = false;
+};
+
+static void bench_frame(lua_State* L) {
+    ImGui::GetIO().DeltaTime = 1.0f / 60.0f;
+    ImGui::NewFrame();
+    ImGui::SetNextWindowPos(ImVec2(0.0f, 0.0f));
+    ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
+    lua_getglobal(L, "__neko_luainspector_draw");
+    lua_getglobal(L, "inspector");
+    if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+        fprintf(stderr, "draw: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+    ImGui::Render();
+}
+
+static void bench_settle(lua_State* L, neko::luainspector* inspector, int max_frames) {
+    for (int i = 0; i < max_frames; ++i) {
+        bench_frame(L);
+        if (!inspector->walking() && !inspector->snapshot().dirty && i > 2) break;
+    }
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    std::size_t i = (std::size_t)(p * (double)(sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+static bool bench_run(const bench_workload& w, const bench_options& opt) {
+    lua_State* L = lua_newstate(bench_lua_alloc, NULL);
+    luaL_openlibs(L);
+
+    lua_register(L, "__neko_luainspector_init", neko::luainspector::luainspector_init);
+    lua_register(L, "__neko_luainspector_draw", neko::luainspector::luainspector_draw);
+    lua_register(L, "__neko_luainspector_get", neko::luainspector::luainspector_get);
+    lua_register(L, "__bench_make_userdata", bench_make_userdata);
+
+    if (luaL_dostring(L, "inspector = __neko_luainspector_init()") || luaL_dostring(L, w.script)) {
+        fprintf(stderr, "%s: %s\n", w.name, lua_tostring(L, -1));
+        lua_close(L);
+        return false;
+    }
+    lua_getglobal(L, "inspector");
+    neko::luainspector* inspector = (neko::luainspector*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    char line[64];
+    for (int i = 0; i < w.log_lines; ++i) {
+        int n = snprintf(line, sizeof(line), "bench log line %d", i);
+        inspector->print_line(std::string_view(line, (std::size_t)n), (neko::luainspector_logtype)(i % 3));
+    }
+
+    inspector->add_watch("collectgarbage('count')");
+
+    std::vector<double> times;
+    times.reserve((std::size_t)opt.frames);
+    bool clean = true;
+
+    for (const char* tab : s_tabs) {
+        inspector->select_tab(tab);
+        bench_settle(L, inspector, opt.warmup);
+        for (int d = 1; d <= opt.depth; ++d) {
+            inspector->expand_rows(d);
+            bench_settle(L, inspector, opt.warmup);
+        }
+
+        // Periodic rebuilds grow their buffers on the first go round and reuse them after, run one more
+        // measurement's worth of frames so the check sees the reuse
+        if (opt.check_alloc) {
+            for (int i = 0; i < opt.frames; ++i) bench_frame(L);
+        }
+
+        times.clear();
+        std::size_t news = g_new_count.load(std::memory_order_relaxed), luas = g_lua_count, imguis = g_imgui_count;
+        for (int i = 0; i < opt.frames; ++i) {
+            auto t0 = std::chrono::steady_clock::now();
+            bench_frame(L);
+            auto t1 = std::chrono::steady_clock::now();
+            times.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+        }
+        news = g_new_count.load(std::memory_order_relaxed) - news;
+        luas = g_lua_count - luas;
+        imguis = g_imgui_count - imguis;
+
+        std::sort(times.begin(), times.end());
+        const double frames = (double)opt.frames;
+        printf("{\"workload\":\"%s\",\"tab\":\"%s\",\"frames\":%d,\"rows\":%zu,"
+               "\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,"
+               "\"new_per_frame\":%.2f,\"lua_alloc_per_frame\":%.2f,\"imgui_alloc_per_frame\":%.2f}\n",
+               w.name, tab, opt.frames, inspector->snapshot().rows.size(), percentile(times, 0.50), percentile(times, 0.90), percentile(times, 0.99), times.back(),
+               (double)news / frames, (double)luas / frames, (double)imguis / frames);
+        fflush(stdout);
+
+        if (opt.check_alloc && news + luas + imguis != 0) {
+            fprintf(stderr, "%s/%s: %zu new, %zu lua, %zu imgui allocations over %d steady frames\n", w.name, tab, news, luas, imguis, opt.frames);
+            clean = false;
+        }
+    }
+
+    lua_close(L);
+    return clean;
+}
+
+// Names of the children of the snapshot root in Registry sort order, space separated
+static std::string bench_sorted_names(neko::luainspector* inspector) {
+    const neko::inspect_table_snapshot& snap = inspector->snapshot();
+    std::string names;
+    for (std::uint32_t k : inspector->sorted_children(0)) {
+        if (!names.empty()) names += ' ';
+        names += snap.name(snap.rows[snap.rows[0].child_begin + k]);
+    }
+    return names;
+}
+
+// A value that changes type keeps its row id, a Type sort must still see the change
+static bool bench_check_sort() {
+    lua_State* L = lua_newstate(bench_lua_alloc, NULL);
+    luaL_openlibs(L);
+    lua_register(L, "__neko_luainspector_init", neko::luainspector::luainspector_init);
+    luaL_dostring(L, "inspector = __neko_luainspector_init() sorted = {a = 1, b = 'x', c = true}");
+    lua_getglobal(L, "inspector");
+    neko::luainspector* inspector = (neko::luainspector*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    inspector->set_sort(1, true);
+    lua_getglobal(L, "sorted");
+    inspector->refresh_snapshot(L);
+    const std::string before = bench_sorted_names(inspector);
+    luaL_dostring(L, "sorted.a = {}");
+    inspector->refresh_snapshot(L);
+    const std::string after = bench_sorted_names(inspector);
+    lua_close(L);
+
+    const bool ok = before == "c a b" && after == "c b a";
+    if (!ok) fprintf(stderr, "sort by type: \"%s\" then \"%s\", expected \"c a b\" then \"c b a\"\n", before.c_str(), after.c_str());
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    bench_options opt;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            opt.frames = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--depth") && i + 1 < argc) {
+            opt.depth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--workload") && i + 1 < argc) {
+            opt.only = argv[++i];
+        } else if (!strcmp(argv[i], "--check-alloc")) {
+            opt.check_alloc = true;
+        } else if (!strcmp(argv[i], "--check-sort")) {
+            opt.check_sort = true;
+        } else {
+            fprintf(stderr, "usage: %s [--frames N] [--depth N] [--workload NAME] [--check-alloc] [--check-sort]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    ImGui::SetAllocatorFunctions(bench_imgui_alloc, bench_imgui_free, NULL);
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGuiIO& io = ImGui::GetIO();
+    io.DisplaySize = ImVec2(1920.0f, 1080.0f);
+    io.IniFilename = NULL;
+    unsigned char* pixels;
+    int width, height;
+    io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+
+    bool ok = !opt.check_sort || bench_check_sort();
+    for (const bench_workload& w : s_workloads) {
+        if (opt.only && strcmp(opt.only, w.name) != 0) continue;
+        ok = bench_run(w, opt) && ok;
+    }
+
+    ImGui::DestroyContext();
+    return ok ? 0 : 1;
+}
@@ -1,9 +1,19 @@
 #include "imgui_lua_inspector.hpp"
 
 #include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
-#include <sstream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NEKO_LUAINSPECTOR_SSE2 1
+#else
+#define NEKO_LUAINSPECTOR_SSE2 0
+#endif
 
 static int __luainspector_echo(lua_State* L) {
     neko::luainspector* m = *static_cast<neko::luainspector**>(lua_touserdata(L, lua_upvalueindex(1)));
@@ -11,6 +21,90 @@ static int __luainspector_echo(lua_State* L) {
     return 0;
 }
 
+static int __luainspector_profiler_start(lua_State* L) {
+    neko::luainspector* m = *static_cast<neko::luainspector**>(lua_touserdata(L, lua_upvalueindex(1)));
+    if (!m) return 0;
+    neko::luainspector_profiler& prof = m->profiler();
+    prof.period = static_cast<int>(luaL_optinteger(L, 1, prof.period));
+    prof.interval_us = static_cast<int>(luaL_optinteger(L, 2, prof.interval_us));
+    luaL_argcheck(L, prof.period > 0, 1, "period must be positive");
+    prof.start();
+    if (!m->update_hook()) {
+        prof.stop();
+        return luaL_error(L, "another hook is installed on this state");
+    }
+    return 0;
+}
+
+static int __luainspector_profiler_stop(lua_State* L) {
+    neko::luainspector* m = *static_cast<neko::luainspector**>(lua_touserdata(L, lua_upvalueindex(1)));
+    if (m) {
+        m->profiler().stop();
+        m->update_hook();
+    }
+    return 0;
+}
+
+static int __luainspector_profiler_reset(lua_State* L) {
+    neko::luainspector* m = *static_cast<neko::luainspector**>(lua_touserdata(L, lua_upvalueindex(1)));
+    if (m) m->profiler().reset();
+    return 0;
+}
+
+static int __luainspector_profiler_save(lua_State* L) {
+    neko::luainspector* m = *static_cast<neko::luainspector**>(lua_touserdata(L, lua_upvalueindex(1)));
+    const char* path = luaL_optstring(L, 1, "luainspector.folded");
+    lua_pushboolean(L, m && m->profiler().save_collapsed(path));
+    return 1;
+}
+
+// us, instructions, allocated, freed, gc cycles of the running console command so far
+static int __luainspector_command_stats(lua_State* L) {
+    neko::luainspector* m = *static_cast<neko::luainspector**>(lua_touserdata(L, lua_upvalueindex(1)));
+    const neko::luainspector_command_stats stats = m ? m->command_stats() : neko::luainspector_command_stats{};
+    lua_pushnumber(L, stats.us);
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.instructions));
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.allocated));
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.freed));
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.gc_cycles));
+    return 5;
+}
+
+// __gc of an unreachable userdata, it dies with every collection and makes a new one to die in the next
+static int __luainspector_gc_sentinel(lua_State* L) {
+    neko::luainspector* m = *static_cast<neko::luainspector**>(lua_touserdata(L, lua_upvalueindex(1)));
+    if (!m || !m->command_gc_cycle(static_cast<std::uint32_t>(lua_tointeger(L, lua_upvalueindex(2))))) return 0;
+    lua_newuserdata(L, 0);
+    lua_getmetatable(L, 1);
+    lua_setmetatable(L, -2);
+    return 0;
+}
+
+// bench(fn [, n]) runs fn n times and reports the spread of its run time. In a console command it is timed with
+// the command's own clock, so the frames a budgeted command waits in between are not counted.
+static const char kBenchSource[] = R"lua(
+local stats, echo = ...
+return function(fn, n)
+    n = math.tointeger(n) or 100
+    assert(type(fn) == "function", "bench(fn [, n]): fn must be a function")
+    assert(n > 0, "bench(fn [, n]): n must be positive")
+    local times = {}
+    local us0, ins0, alloc0, free0, gc0 = stats()
+    for i = 1, n do
+        local start = stats()
+        fn()
+        times[i] = stats() - start
+    end
+    local us1, ins1, alloc1, free1, gc1 = stats()
+    table.sort(times)
+    local function at(p) return times[math.max(1, math.ceil(p * n))] / 1000 end
+    local min, median, p99 = times[1] / 1000, at(0.5), at(0.99)
+    echo(string.format("bench x%d: min %.4f ms, median %.4f ms, p99 %.4f ms | per run ~%d instructions, %d bytes allocated, %d freed | %d GC cycles",
+        n, min, median, p99, (ins1 - ins0) // n, (alloc1 - alloc0) // n, (free1 - free0) // n, gc1 - gc0))
+    return min, median, p99
+end
+)lua";
+
 static int __luainspector_gc(lua_State* L) {
     neko::luainspector* m = *static_cast<neko::luainspector**>(lua_touserdata(L, 1));
     if (m) m->setL(0x0);
@@ -19,8 +113,10 @@ static int __luainspector_gc(lua_State* L) {
 
 namespace neko {
 
-std::string luainspector_hints::clean_table_list(const std::string& str) {
-    std::string ret;
+// Reduce the input to the dotted table path being typed, e.g. "print(foo . bar:ba" -> "foo.bar.ba". Written into out,
+// which is kept by the caller so typing does not allocate.
+std::string_view luainspector_hints::clean_table_list(std::string_view str, std::string& out) {
+    out.clear();
     bool got_dot = false, got_white = false;
     std::size_t whitespace_start = 0u;
     for (std::size_t i = 0u; i < str.size(); ++i) {
@@ -29,78 +125,60 @@ std::string luainspector_hints::clean_table_list(const std::string& str) {
             got_white = true;
             whitespace_start = i;
         }
-        if (c == '.' && got_white) {
-            for (std::size_t j = 0u; j < (i - whitespace_start); ++j) ret.erase(--ret.end());
-        }
+        if (c == '.' && got_white) out.resize(out.size() - std::min(out.size(), i - whitespace_start));
         if (c != ' ') got_white = false;
-        if (c != ' ' || !got_dot) ret += c;
+        if (c != ' ' || !got_dot) out += c;
         if (c == '.') got_dot = true;
         if (c != '.' && c != ' ') got_dot = false;
     }
 
-    const std::string specials = "()[]{}\"'+-=/*^%#~,";
-    for (std::size_t i = 0u; i < specials.size(); ++i) std::replace(ret.begin(), ret.end(), specials[i], ' ');
+    constexpr std::string_view specials = "()[]{}\"'+-=/*^%#~,";
+    for (char& c : out) {
+        if (specials.find(c) != std::string_view::npos) c = ' ';
+    }
 
-    ret = ret.substr(ret.find_last_of(' ') + 1u);
-    return ret;
+    const std::string_view ret = out;
+    return ret.substr(ret.find_last_of(' ') + 1u);
 }
 
-void luainspector_hints::prepare_hints(lua_State* L, std::string str, std::string& last) {
-    str = clean_table_list(str);
+// Push the table the dotted path in str leads to and return the word being typed after its last dot
+std::string_view luainspector_hints::prepare_hints(lua_State* L, std::string_view str, std::string& scratch) {
+    const std::string_view path = clean_table_list(str, scratch);
 
-    std::vector<std::string> tables;
-    int begin = 0;
-    for (std::size_t i = 0u; i < str.size(); ++i) {
-        if (str[i] == '.') {
-            tables.push_back(str.substr(begin, i - begin));
-            begin = i + 1;
-        }
-    }
-    last = str.substr(begin);
+    const std::size_t dot = path.rfind('.');
+    const std::string_view last = dot == std::string_view::npos ? path : path.substr(dot + 1);
 
     lua_pushglobaltable(L);
-    for (std::size_t i = 0u; i < tables.size(); ++i) {
+    std::size_t begin = 0;
+    for (std::size_t i = 0u; dot != std::string_view::npos && i <= dot; ++i) {
+        if (path[i] != '.') continue;
+        const std::string_view table = path.substr(begin, i - begin);
+        begin = i + 1;
+
         if (lua_type(L, -1) != LUA_TTABLE) {
             lua_getmetatable(L, -1);
         }
 
         if (lua_type(L, -1) != LUA_TTABLE && !luaL_getmetafield(L, -1, "__index") && !lua_getmetatable(L, -1)) break;
         if (lua_type(L, -1) != LUA_TTABLE) break;  // no
-        lua_pushlstring(L, tables[i].c_str(), tables[i].size());
-        lua_gettable(L, -2);
-    }
-}
-
-bool luainspector_hints::collect_hints_recurse(lua_State* L, std::vector<std::string>& possible, const std::string& last, bool usehidden, unsigned left) {
-    if (left == 0u) return true;
-
-    const bool skip_under_score = last.empty() && !usehidden;
-
-    lua_pushnil(L);
-    while (lua_next(L, -2)) {
-        std::size_t keylen;
-        const char* key;
-        bool match = true;
-        lua_pop(L, 1);
-        lua_pushvalue(L, -1);  // for lua_next
-        key = lua_tolstring(L, -1, &keylen);
-        if (last.size() > keylen) {
+        lua_pushlstring(L, table.data(), table.size());
+        lua_rawget(L, -2);
+        // This runs on every edit of the input, so only raw reads: __index tables are followed like collect_keys()
+        // does, an __index function is never called
+        for (unsigned left = 10u; left > 0u && lua_isnil(L, -1); --left) {
             lua_pop(L, 1);
-            continue;
+            const int index = luaL_getmetafield(L, -1, "__index");
+            if (index != LUA_TTABLE) {
+                if (index != LUA_TNIL) lua_pop(L, 1);
+                lua_pushnil(L);
+                break;
+            }
+            lua_replace(L, -2);
+            lua_pushlstring(L, table.data(), table.size());
+            lua_rawget(L, -2);
         }
-        for (std::size_t i = 0u; i < last.size(); ++i)
-            if (key[i] != last[i]) match = false;
-        if (match && (!skip_under_score || key[0] != '_')) possible.push_back(key);
-        lua_pop(L, 1);  //
-    }
-
-    // Check whether the table itself has an index for linking elements
-    if (luaL_getmetafield(L, -1, "__index")) {
-        if (lua_istable(L, -1)) return collect_hints_recurse(L, possible, last, usehidden, left - 1);
-        lua_pop(L, 1);  // pop
     }
-    lua_pop(L, 1);  // pop table
-    return true;
+    return last;
 }
 
 // Replace the value at the top of the stack with the __index TABLE from the metatable
@@ -117,695 +195,4134 @@ bool luainspector_hints::try_replace_with_metaindex(lua_State* L) {
     return true;
 }
 
-bool luainspector_hints::collect_hints(lua_State* L, std::vector<std::string>& possible, const std::string& last, bool usehidden) {
-    if (lua_type(L, -1) != LUA_TTABLE && !luainspector_hints::try_replace_with_metaindex(L)) return false;
-    // table so just collect on it
-    return collect_hints_recurse(L, possible, last, usehidden, 10u);
+// Keys of the table at the top of the stack and of its __index tables, sorted and without duplicates
+void luainspector_hints::collect_keys(lua_State* L, luainspector_completion_entry& entry) {
+    entry.text.clear();
+    entry.keys.clear();
+
+    lua_pushvalue(L, -1);
+    for (unsigned left = 10u; left > 0u && lua_type(L, -1) == LUA_TTABLE; --left) {
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            // Only string keys can be typed as identifiers, and lua_tolstring must not convert keys during lua_next
+            if (lua_type(L, -2) == LUA_TSTRING) {
+                std::size_t len;
+                const char* key = lua_tolstring(L, -2, &len);
+                entry.keys.push_back({static_cast<std::uint32_t>(entry.text.size()), static_cast<std::uint32_t>(len), -1.f});
+                entry.text.insert(entry.text.end(), key, key + len + 1);
+            }
+            lua_pop(L, 1);
+        }
+        if (!luaL_getmetafield(L, -1, "__index")) break;
+        lua_remove(L, -2);
+    }
+    lua_pop(L, 1);
+
+    auto name = [&entry](const luainspector_completion_entry::key& k) { return std::string_view(&entry.text[k.off], k.len); };
+    std::sort(entry.keys.begin(), entry.keys.end(), [&name](const auto& a, const auto& b) { return name(a) < name(b); });
+    entry.keys.erase(std::unique(entry.keys.begin(), entry.keys.end(), [&name](const auto& a, const auto& b) { return name(a) == name(b); }), entry.keys.end());
 }
 
-std::string luainspector_hints::common_prefix(const std::vector<std::string>& possible) {
-    std::string ret;
-    std::size_t maxindex = 1000000000u;
-    for (std::size_t i = 0u; i < possible.size(); ++i) maxindex = std::min(maxindex, possible[i].size());
-    for (std::size_t checking = 0u; checking < maxindex; ++checking) {
-        const char c = possible[0u][checking];
-        for (std::size_t i = 1u; i < possible.size(); ++i)
-            if (c != possible[i][checking]) {
-                checking = maxindex;
-                break;
-            }
-        if (checking != maxindex) ret += c;
+// Subsequence match of pattern in str, -1 when it does not match. Prefix matches always outrank the rest,
+// then consecutive characters and characters at word starts (after '_' or a lower/upper case change) score higher.
+int luainspector_hints::fuzzy_score(std::string_view pattern, std::string_view str) {
+    if (pattern.size() > str.size()) return -1;
+    if (str.substr(0, pattern.size()) == pattern) return (1 << 20) - static_cast<int>(str.size());
+
+    auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; };
+    int score = 0;
+    std::size_t p = 0;
+    std::size_t prev = std::string_view::npos;
+    for (std::size_t i = 0; i < str.size() && p < pattern.size(); ++i) {
+        if (lower(str[i]) != lower(pattern[p])) continue;
+        int bonus = 1;
+        if (str[i] == pattern[p]) bonus += 1;
+        if (prev != std::string_view::npos && i == prev + 1) bonus += 5;
+        if (i == 0) {
+            bonus += 10;
+        } else if (str[i - 1] == '_' || (str[i - 1] >= 'a' && str[i - 1] <= 'z' && str[i] >= 'A' && str[i] <= 'Z')) {
+            bonus += 8;
+        }
+        score += bonus;
+        prev = i;
+        ++p;
     }
-    return ret;
+    if (p < pattern.size()) return -1;
+    return score * 16 - static_cast<int>(str.size());
 }
 
-}  // namespace neko
+void luainspector_log::reserve(std::size_t byte_budget, std::size_t max_entries) {
+    m_chunk_count = std::max<std::size_t>(2u, byte_budget / kChunkSize);
+    m_text.assign(m_chunk_count * kChunkSize, '\0');
+    m_entries.assign(std::max<std::size_t>(1u, max_entries), entry{});
+    m_chunk = m_pos = m_head = m_count = 0;
+    m_evicted = 0;
+}
 
-const char* const kMetaname = "__neko_lua_inspector_meta";
+void luainspector_log::push(std::string_view msg, luainspector_logtype type) {
+    if (m_text.empty()) reserve(kDefaultBytes, kDefaultEntries);
 
-static void* __neko_lua_inspector_lightkey() {
-    static char KEY;
-    return &KEY;
-}
+    const std::size_t len = std::min(msg.size(), kChunkSize);
+    if (m_pos + len > kChunkSize || m_pos == kChunkSize) {
+        m_chunk = (m_chunk + 1) % m_chunk_count;
+        m_pos = 0;
+        // The next chunk holds the oldest text, drop the entries that still point into it
+        while (m_count > 0 && (*this)[0].off / kChunkSize == m_chunk) pop_front();
+    }
+    if (m_count == m_entries.size()) pop_front();
 
-static void* __neko_lua_inspector_print_func_lightkey() {
-    static char KEY;
-    return &KEY;
+    const std::size_t off = m_chunk * kChunkSize + m_pos;
+    std::memcpy(m_text.data() + off, msg.data(), len);
+    m_entries[(m_head + m_count) % m_entries.size()] = {static_cast<std::uint32_t>(off), static_cast<std::uint32_t>(len), static_cast<std::uint8_t>(type)};
+    ++m_count;
+    m_pos += len;
 }
 
-neko::luainspector* neko::luainspector::get_from_registry(lua_State* L) {
-    lua_pushlightuserdata(L, __neko_lua_inspector_lightkey());  // # -1
-    lua_gettable(L, LUA_REGISTRYINDEX);
-
-    neko::luainspector* ret = nullptr;
+static inline std::uint32_t trigram_of(const char* str) {
+    return static_cast<unsigned char>(str[0]) | static_cast<unsigned char>(str[1]) << 8 | static_cast<std::uint32_t>(static_cast<unsigned char>(str[2])) << 16;
+}
 
-    if (lua_type(L, -1) == LUA_TUSERDATA && lua_getmetatable(L, -1)) {
-        // # -1 = metatable
-        // # -2 = userdata
-        lua_getfield(L, LUA_REGISTRYINDEX, kMetaname);  // get inspector metatable from registry
-        // # -1 = metatable
-        // # -2 = metatable
-        // # -3 = userdata
-        if (neko_lua_equal(L, -1, -2)) {                                      // determine is two metatable equal
-            ret = *static_cast<neko::luainspector**>(lua_touserdata(L, -3));  // inspector userdata
-        }
+// Empty the index for another walk. Vectors keep their capacity and trigram postings are emptied rather than
+// erased, so an index rebuilt over a similar heap allocates nothing.
+void luainspector_search_index::clear() {
+    entries.clear();
+    keys.clear();
+    for (auto& posting : trigrams) posting.second.clear();
+    tables.clear();
+}
 
-        lua_pop(L, 2);  // pop two
+void luainspector_search_index::add_entry(std::uint64_t id, std::uint32_t parent, const char* key, std::size_t len, int type) {
+    const std::uint32_t index = static_cast<std::uint32_t>(entries.size());
+    entries.push_back({id, parent, static_cast<std::uint32_t>(keys.size()), static_cast<std::uint32_t>(len), static_cast<std::uint8_t>(type)});
+    keys.insert(keys.end(), key, key + len);
+    for (std::size_t i = 0; i + 3 <= len; ++i) {
+        std::vector<std::uint32_t>& posting = trigrams[trigram_of(key + i)];
+        if (posting.empty() || posting.back() != index) posting.push_back(index);
     }
-
-    lua_pop(L, 1);  // pop inspector userdata
-    return ret;
 }
 
-void neko::luainspector::print_luastack(int first, int last, luainspector_logtype logtype) {
-    std::stringstream ss;
-    for (int i = first; i <= last; ++i) {
-        switch (lua_type(L, i)) {
-            case LUA_TNUMBER:
-                ss << lua_tostring(L, i);
-                break;
-            case LUA_TSTRING:
-                ss << "'" << lua_tostring(L, i) << "'";
-                break;
-            case LUA_TBOOLEAN:
-                ss << (lua_toboolean(L, i) ? "true" : "false");
-                break;
-            case LUA_TNIL:
-                ss << "nil";
-                break;
-            default:
-                ss << luaL_typename(L, i) << ": " << lua_topointer(L, i);
-                break;
-        }
-        ss << ' ';
+// Write the full dotted path of an entry (truncated to size - 1, nul terminated), returns its untruncated length
+std::size_t luainspector_search_index::path(std::uint32_t index, char* buf, std::size_t size) const {
+    std::size_t len = 0;
+    for (std::uint32_t i = index; i != kNoParent; i = entries[i].parent) len += entries[i].key_len + (entries[i].parent != kNoParent ? 1 : 0);
+    if (size == 0) return len;
+
+    const std::size_t end = std::min(len, size - 1);
+    buf[end] = '\0';
+    std::size_t pos = len;
+    for (std::uint32_t i = index; i != kNoParent; i = entries[i].parent) {
+        const entry& e = entries[i];
+        pos -= e.key_len;
+        for (std::size_t k = 0; k < e.key_len && pos + k < end; ++k) buf[pos + k] = keys[e.key_off + k];
+        if (e.parent != kNoParent && --pos < end) buf[pos] = '.';
     }
-    print_line(ss.str(), logtype);
+    return len;
 }
 
-bool neko::luainspector::try_eval(std::string m_buffcmd, bool addreturn) {
-    if (addreturn) {
-        const std::string code = "return " + m_buffcmd;
-        if (LUA_OK == luaL_loadstring(L, code.c_str())) {
-            return true;
-        } else {
-            lua_pop(L, 1);  // pop error
-            return false;
+// Entries whose own key contains the last component of q and whose full path contains q. Queries of three
+// or more characters only visit the entries on the shortest trigram posting list of that component.
+void luainspector_search_index::query(std::string_view q, std::size_t max_results, std::vector<std::uint32_t>& out, std::size_t& total) const {
+    out.clear();
+    total = 0;
+    if (q.empty()) return;
+
+    const std::size_t dot = q.rfind('.');
+    const std::string_view tail = dot == std::string_view::npos ? q : q.substr(dot + 1);
+    char path_buf[1024];
+
+    auto verify = [&](std::uint32_t i) {
+        const entry& e = entries[i];
+        if (std::string_view(keys.data() + e.key_off, e.key_len).find(tail) == std::string_view::npos) return;
+        if (dot != std::string_view::npos) {
+            const std::size_t len = std::min(path(i, path_buf, sizeof(path_buf)), sizeof(path_buf) - 1);
+            if (std::string_view(path_buf, len).find(q) == std::string_view::npos) return;
         }
-    } else {
-        return LUA_OK == luaL_loadstring(L, m_buffcmd.c_str());
+        if (total++ < max_results) out.push_back(i);
+    };
+
+    if (tail.size() < 3) {
+        for (std::uint32_t i = 0; i < entries.size(); ++i) verify(i);
+        return;
     }
-}
 
-// Avoid error when calling with non-strings
-static inline std::string adjust_error_msg(lua_State* L, int idx) {
-    const int t = lua_type(L, idx);
-    if (t == LUA_TSTRING) return lua_tostring(L, idx);
-    return std::string("(non string error value - ") + lua_typename(L, t) + ")";
+    const std::vector<std::uint32_t>* shortest = nullptr;
+    for (std::size_t i = 0; i + 3 <= tail.size(); ++i) {
+        auto it = trigrams.find(trigram_of(tail.data() + i));
+        if (it == trigrams.end() || it->second.empty()) return;
+        if (!shortest || it->second.size() < shortest->size()) shortest = &it->second;
+    }
+    for (std::uint32_t i : *shortest) verify(i);
 }
 
-void neko::luainspector::setL(lua_State* L) {
-    this->L = L;
-
-    if (!L) return;
+static inline int size_class_of(std::size_t size) {
+    int c = 0;
+    while (c < luainspector_memprof::kSizeClasses - 1 && (static_cast<std::size_t>(1) << c) < size) ++c;
+    return c;
+}
 
-    neko::luainspector** ptr = static_cast<neko::luainspector**>(lua_newuserdata(L, sizeof(neko::luainspector*)));
-    (*ptr) = this;
+bool luainspector_memprof::install(lua_State* L, bool counters_only) {
+    if (m_L && m_L != L) return false;
+    if (m_L && (counters_only || !m_counters_only)) return true;
+    if (!m_L) {
+        void* ud = nullptr;
+        lua_Alloc f = lua_getallocf(L, &ud);
+        if (f == &alloc) return false;  // another profiler already wraps this state
+        m_L = L;
+        m_alloc = f;
+        m_ud = ud;
+        lua_setallocf(L, &alloc, this);
+    }
+    m_counters_only = counters_only;
+    if (!counters_only) m_live = m_peak = static_cast<std::uint64_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + static_cast<std::uint64_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+    return true;
+}
 
-    luaL_newmetatable(L, kMetaname);  // table
-    lua_pushliteral(L, "__gc");
-    lua_pushcfunction(L, &__luainspector_gc);
-    lua_settable(L, -3);  // table[gc]=ConsoleModel_gc
-    lua_setmetatable(L, -2);
+// Blocks handed out while installed go back through the wrapped allocator, so they can be freed either way
+void luainspector_memprof::uninstall() {
+    if (!m_L) return;
+    void* ud = nullptr;
+    if (lua_getallocf(m_L, &ud) == &alloc && ud == this) lua_setallocf(m_L, m_alloc, m_ud);
+    m_L = nullptr;
+    m_counters_only = false;
+}
 
-    lua_pushlightuserdata(L, __neko_lua_inspector_lightkey());
-    lua_pushvalue(L, -2);
-    lua_settable(L, LUA_REGISTRYINDEX);
+void luainspector_memprof::reset() {
+    m_peak = m_live;
+    m_allocs = m_frees = m_reallocs = 0;
+    std::fill(std::begin(m_class_count), std::end(m_class_count), 0);
+    std::fill(std::begin(m_class_bytes), std::end(m_class_bytes), 0);
+    m_pending_count = m_pending_bytes = 0;
+    m_sites.clear();
+    m_site_index.clear();
+    m_frame_mark = 0;
+}
 
-    lua_pushcclosure(L, &__luainspector_echo, 1);
-    lua_setglobal(L, "echo");
+void luainspector_memprof::sample_frame(lua_State* L) {
+    const std::uint64_t heap = m_L && !m_counters_only ? m_live : static_cast<std::uint64_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + static_cast<std::uint64_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+    m_heap_kb[m_history_head] = static_cast<float>(heap) / 1024.0f;
+    m_frame_allocs[m_history_head] = static_cast<float>(m_allocs - m_frame_mark);
+    m_frame_mark = m_allocs;
+    m_history_head = (m_history_head + 1) % kHistory;
 }
 
-std::string neko::luainspector::read_history(int change) {
-    const bool was_promp = static_cast<std::size_t>(m_hindex) == m_history.size();
+void* luainspector_memprof::alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+    luainspector_memprof* self = static_cast<luainspector_memprof*>(ud);
+    void* ret = self->m_alloc(self->m_ud, ptr, osize, nsize);
+    if (nsize != 0 && !ret) return ret;
 
-    m_hindex += change;
-    m_hindex = std::max<int>(m_hindex, 0);
-    m_hindex = std::min<int>(m_hindex, m_history.size());
+    if (self->m_counters_only) {
+        if (ptr && nsize < osize) self->m_freed_bytes += osize - nsize;
+        if (nsize > (ptr ? osize : 0)) self->m_allocated_bytes += nsize - (ptr ? osize : 0);
+        return ret;
+    }
 
-    if (static_cast<std::size_t>(m_hindex) == m_history.size()) {
-        return m_history[m_hindex - 1];
+    // With ptr == NULL, osize is the type of the new object rather than a size
+    if (ptr) self->m_live -= osize;
+    if (nsize == 0) {
+        if (ptr) {
+            ++self->m_frees;
+            self->m_freed_bytes += osize;
+        }
+        return ret;
+    }
+    self->m_live += nsize;
+    self->m_peak = std::max(self->m_peak, self->m_live);
+
+    const std::size_t grown = ptr ? (nsize > osize ? nsize - osize : 0) : nsize;
+    self->m_allocated_bytes += grown;
+    if (ptr && nsize < osize) self->m_freed_bytes += osize - nsize;
+    if (ptr) {
+        ++self->m_reallocs;
     } else {
-        return m_history[m_hindex];
+        ++self->m_allocs;
     }
+    const int c = size_class_of(nsize);
+    ++self->m_class_count[c];
+    self->m_class_bytes[c] += grown;
+    ++self->m_pending_count;
+    self->m_pending_bytes += grown;
+    return ret;
 }
 
-std::string neko::luainspector::try_complete(std::string inputbuffer) {
-    if (!L) {
-        print_line("Lua state pointer is NULL, no completion available", LUACON_LOG_TYPE_ERROR);
-        return inputbuffer;
-    }
-
-    std::vector<std::string> possible;  // possible match
-    std::string last;
+void luainspector_memprof::on_count_hook(lua_State* L, lua_Debug* ar) {
+    if (!m_L || m_counters_only || m_pending_count == 0 || !lua_getinfo(L, "Sl", ar)) return;
+    charge(ar->short_src, ar->currentline);
+}
 
-    const std::string lastbeg = inputbuffer;
-    luainspector_hints::prepare_hints(L, lastbeg, last);
-    if (!luainspector_hints::collect_hints(L, possible, last, false)) {
-        lua_pushglobaltable(L);
-        luainspector_hints::collect_hints(L, possible, last, false);
+void luainspector_memprof::charge(const char* source, int line) {
+    const std::size_t len = std::strlen(source);
+    const std::uint64_t id = neko_hash_str(reinterpret_cast<const char*>(&line), sizeof(line), neko_hash_str(source, len));
+
+    std::uint32_t index;
+    auto it = m_site_index.find(id);
+    if (it != m_site_index.end()) {
+        index = it->second;
+    } else if (m_sites.size() < kMaxSites) {
+        index = static_cast<std::uint32_t>(m_sites.size());
+        site& s = m_sites.emplace_back();
+        s.id = id;
+        std::memcpy(s.source, source, std::min(len + 1, sizeof(s.source)));
+        s.source[sizeof(s.source) - 1] = '\0';
+        s.line = line;
+        s.count = s.bytes = 0;
+        m_site_index.emplace(id, index);
+    } else {
+        index = static_cast<std::uint32_t>(m_sites.size() - 1);
     }
 
-    lua_settop(L, 0);  // Pop all
+    m_sites[index].count += m_pending_count;
+    m_sites[index].bytes += m_pending_bytes;
+    m_pending_count = m_pending_bytes = 0;
+}
 
-    if (possible.size() > 1u) {
-        const std::string common_prefix = luainspector_hints::common_prefix(possible);
-        if (common_prefix.empty() || common_prefix.size() <= last.size()) {
-            std::string msg = possible[0];
-            for (std::size_t i = 1u; i < possible.size(); ++i) msg += " " + possible[i];
-            print_line(msg, LUACON_LOG_TYPE_NOTE);
-            m_current_autocomplete_strings = possible;
-        } else {
-            const std::string added = common_prefix.substr(last.size());
-            inputbuffer = lastbeg + added;
-            m_current_autocomplete_strings.clear();
-        }
-    } else if (possible.size() == 1) {
-        const std::string added = possible[0].substr(last.size());
-        inputbuffer = lastbeg + added;
-        m_current_autocomplete_strings.clear();
-    }
-    return inputbuffer;
+void luainspector_profiler::start() {
+    if (m_nodes.empty()) reset();
+    m_running = true;
+    m_last_sample = 0.0;
 }
 
-// void neko::luainspector::set_print_eval_prettifier(lua_State* L) {
-//     if (lua_gettop(L) == 0) return;
+void luainspector_profiler::reset() {
+    m_nodes.clear();
+    m_nodes.push_back({kNoFunc, kNoNode, kNoNode, kNoNode, 0, 0, 0});
+    m_functions.clear();
+    m_text.clear();
+    m_function_index.clear();
+    m_child_index.clear();
+}
 
-//     const int t = lua_type(L, -1);
-//     if (!(t == LUA_TFUNCTION || t == LUA_TNIL)) return;
+void luainspector_profiler::on_count_hook(lua_State* L) {
+    if (!m_running) return;
+    const double now = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (now - m_last_sample < interval_us) return;
+    m_last_sample = now;
+    sample(L);
+}
 
-//     lua_pushlightuserdata(L, __neko_lua_inspector_print_func_lightkey());
-//     lua_insert(L, -2);
-//     lua_settable(L, LUA_REGISTRYINDEX);
-// }
+void luainspector_profiler::sample(lua_State* L) {
+    if (m_nodes.empty()) reset();
+
+    lua_Debug ar;
+    std::uint32_t stack[kMaxDepth];
+    int depth = 0;
+    for (int level = 0; depth < kMaxDepth && lua_getstack(L, level, &ar); ++level) stack[depth++] = intern(L, &ar);
+
+    std::uint32_t n = 0;
+    ++m_nodes[0].total;
+    while (depth > 0) {
+        const std::uint32_t c = child(n, stack[--depth]);
+        if (c == kNoNode) break;
+        n = c;
+        ++m_nodes[n].total;
+    }
+    ++m_nodes[n].self;
+}
 
-// void neko::luainspector::get_print_eval_prettifier(lua_State* L) const {
-//     lua_pushlightuserdata(L, __neko_lua_inspector_print_func_lightkey());
-//     lua_gettable(L, LUA_REGISTRYINDEX);
-// }
+std::uint32_t luainspector_profiler::intern(lua_State* L, lua_Debug* ar) {
+    lua_getinfo(L, "Sf", ar);
+    // Lua functions are told apart by where they are defined, so every closure of a prototype is one function
+    std::uint64_t id;
+    if (ar->what[0] == 'C') {
+        const std::uintptr_t f = reinterpret_cast<std::uintptr_t>(lua_tocfunction(L, -1));
+        id = neko_hash_str(reinterpret_cast<const char*>(&f), sizeof(f));
+    } else {
+        const std::uintptr_t src = reinterpret_cast<std::uintptr_t>(ar->source);
+        id = neko_hash_str(reinterpret_cast<const char*>(&ar->linedefined), sizeof(ar->linedefined), neko_hash_str(reinterpret_cast<const char*>(&src), sizeof(src)));
+    }
+    lua_pop(L, 1);
+
+    auto it = m_function_index.find(id);
+    if (it != m_function_index.end()) return it->second;
+
+    // First sighting, name it after the call that brought it here
+    lua_getinfo(L, "n", ar);
+    char buf[LUA_IDSIZE + 128];
+    int len;
+    if (ar->what[0] == 'C') {
+        len = std::snprintf(buf, sizeof(buf), "%s [C]", ar->name ? ar->name : "?");
+    } else if (ar->what[0] == 'm') {
+        len = std::snprintf(buf, sizeof(buf), "main chunk (%s)", ar->short_src);
+    } else {
+        len = std::snprintf(buf, sizeof(buf), "%s (%s:%d)", ar->name ? ar->name : "?", ar->short_src, ar->linedefined);
+    }
+    len = std::min<int>(len, sizeof(buf) - 1);
 
-// bool neko::luainspector::apply_prettifier(int index) {
-//     get_print_eval_prettifier(L);
-//     if (lua_type(L, -1) == LUA_TNIL) {
-//         lua_pop(L, 1);
-//         return false;
-//     }
+    const std::uint32_t index = static_cast<std::uint32_t>(m_functions.size());
+    m_functions.push_back({static_cast<std::uint32_t>(m_text.size()), static_cast<std::uint32_t>(len)});
+    m_text.insert(m_text.end(), buf, buf + len);
+    m_function_index.emplace(id, index);
+    return index;
+}
 
-//     assert(lua_type(L, -1) == LUA_TFUNCTION);
-//     lua_pushvalue(L, index);
-//     if (LUA_OK == lua_pcall(L, 1, 1, 0)) {
-//         lua_remove(L, index);
-//         lua_insert(L, index);
-//         return true;
-//     } else {
-//         print_line(adjust_error_msg(L, -1), LUACON_LOG_TYPE_ERROR);
-//         lua_pop(L, 1);
-//         return false;
-//     }
-//     return true;
-// }
+std::uint32_t luainspector_profiler::child(std::uint32_t parent, std::uint32_t func) {
+    const std::uint64_t key = static_cast<std::uint64_t>(parent) << 32 | func;
+    auto it = m_child_index.find(key);
+    if (it != m_child_index.end()) return it->second;
+    if (m_nodes.size() >= kMaxNodes) return kNoNode;
+
+    const std::uint32_t index = static_cast<std::uint32_t>(m_nodes.size());
+    m_nodes.push_back({func, parent, kNoNode, m_nodes[parent].first_child, m_nodes[parent].depth + 1, 0, 0});
+    m_nodes[parent].first_child = index;
+    m_child_index.emplace(key, index);
+    return index;
+}
 
-int neko::luainspector::command_line_callback_st(ImGuiInputTextCallbackData* data) noexcept {
-    command_line_input_callback_UserData* user_data = (command_line_input_callback_UserData*)data->UserData;
-    return reinterpret_cast<neko::luainspector*>(user_data->luainspector_ptr)->command_line_input_callback(data);
+void luainspector_profiler::export_collapsed(std::string& out) const {
+    out.clear();
+    std::vector<std::uint32_t> path;
+    char count[32];
+    for (std::uint32_t i = 1; i < m_nodes.size(); ++i) {
+        if (m_nodes[i].self == 0) continue;
+        path.clear();
+        for (std::uint32_t n = i; n != 0; n = m_nodes[n].parent) path.push_back(n);
+        for (std::size_t k = path.size(); k-- > 0;) {
+            // ';' separates frames and the last space starts the count, keep both out of the names
+            for (char c : name(m_nodes[path[k]].func)) out.push_back(c == ';' ? ':' : c);
+            out.push_back(k ? ';' : ' ');
+        }
+        const int len = std::snprintf(count, sizeof(count), "%llu\n", static_cast<unsigned long long>(m_nodes[i].self));
+        out.append(count, static_cast<std::size_t>(len));
+    }
 }
 
-int neko::luainspector::command_line_input_callback(ImGuiInputTextCallbackData* data) {
-    command_line_input_callback_UserData* user_data = (command_line_input_callback_UserData*)data->UserData;
+bool luainspector_profiler::save_collapsed(const char* path) const {
+    std::string out;
+    export_collapsed(out);
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    file.write(out.data(), static_cast<std::streamsize>(out.size()));
+    return static_cast<bool>(file);
+}
 
-    auto paste_buffer = [data](auto begin, auto end, auto buffer_shift) {
-        neko::copy(begin, end, data->Buf + buffer_shift, data->Buf + data->BufSize - 1);
-        data->BufTextLen = std::min(static_cast<int>(std::distance(begin, end) + buffer_shift), data->BufSize - 1);
-        data->Buf[data->BufTextLen] = '\0';
-        data->BufDirty = true;
-        data->SelectionStart = data->SelectionEnd;
-        data->CursorPos = data->BufTextLen;
-    };
+void luainspector_ptr_map::reserve(std::size_t n) {
+    std::size_t cap = 16;
+    while (cap < n * 2) cap <<= 1;
+    if (cap <= m_slots.size()) return;
+
+    std::vector<slot> old;
+    old.swap(m_slots);
+    m_slots.assign(cap, slot{0, 0});
+    m_size = 0;
+    for (const slot& s : old) {
+        if (s.key) insert(s.key, s.value);
+    }
+}
 
-    const char* command_beg = nullptr;
-    command_beg = neko::find_terminating_word(cmd.data(), cmd.data() + cmd.size(), [this](std::string_view sv) { return sv[0] == ' ' ? 1 : 0; });
+std::uint32_t luainspector_ptr_map::find(std::uint64_t key) const {
+    if (m_slots.empty()) return kNone;
+    const std::size_t mask = m_slots.size() - 1;
+    for (std::size_t i = mix(key) & mask;; i = (i + 1) & mask) {
+        if (m_slots[i].key == key) return m_slots[i].value;
+        if (m_slots[i].key == 0) return kNone;
+    }
+}
 
-    if (data->EventKey == ImGuiKey_Tab) {
-        std::string complete = this->try_complete(cmd);
-        if (!complete.empty()) {
-            paste_buffer(complete.data(), complete.data() + complete.size(), command_beg - cmd.data());
-            // neko_log_trace("%s", complete.c_str());
+std::uint32_t luainspector_ptr_map::insert(std::uint64_t key, std::uint32_t value) {
+    if ((m_size + 1) * 2 > m_slots.size()) reserve(m_size + 1);
+    const std::size_t mask = m_slots.size() - 1;
+    for (std::size_t i = mix(key) & mask;; i = (i + 1) & mask) {
+        if (m_slots[i].key == key) return m_slots[i].value;
+        if (m_slots[i].key == 0) {
+            m_slots[i] = {key, value};
+            ++m_size;
+            return kNone;
         }
     }
-    if (data->EventKey == ImGuiKey_UpArrow) {
-        cmd2 = this->read_history(-1);
-        paste_buffer(cmd2.data(), cmd2.data() + cmd2.size(), command_beg - cmd.data());
-        // neko_log_trace("h:%s", cmd2.c_str());
-    }
-    if (data->EventKey == ImGuiKey_DownArrow) {
-        cmd2 = this->read_history(1);
-        paste_buffer(cmd2.data(), cmd2.data() + cmd2.size(), command_beg - cmd.data());
-        // neko_log_trace("h:%s", cmd2.c_str());
-    }
+}
 
-    if (data->EventFlag == ImGuiInputTextFlags_CallbackResize) {
-        std::string* str = user_data->Str;
-        neko_assert(data->Buf == str->c_str());
-        str->resize(data->BufTextLen);
-        data->Buf = (char*)str->c_str();
-    } else if (user_data->ChainCallback) {
-        data->UserData = user_data->ChainCallbackUserData;
-        return user_data->ChainCallback(data);
+// Backward shift: entries after the hole that probed past it move into it, so lookups never stop early
+bool luainspector_ptr_map::erase(std::uint64_t key) {
+    if (m_slots.empty()) return false;
+    const std::size_t mask = m_slots.size() - 1;
+    std::size_t i = mix(key) & mask;
+    for (; m_slots[i].key != key; i = (i + 1) & mask) {
+        if (m_slots[i].key == 0) return false;
     }
-    return 0;
+    for (std::size_t j = (i + 1) & mask; m_slots[j].key != 0; j = (j + 1) & mask) {
+        const std::size_t home = mix(m_slots[j].key) & mask;
+        const bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (stays) continue;
+        m_slots[i] = m_slots[j];
+        i = j;
+    }
+    m_slots[i] = slot{0, 0};
+    --m_size;
+    return true;
 }
 
-bool neko::luainspector::command_line_input(const char* label, std::string* str, ImGuiInputTextFlags flags, ImGuiInputTextCallback callback, void* user_data) {
-    IM_ASSERT((flags & ImGuiInputTextFlags_CallbackResize) == 0);
-    flags |= ImGuiInputTextFlags_CallbackResize;
-
-    command_line_input_callback_UserData cb_user_data;
-    cb_user_data.Str = str;
-    cb_user_data.ChainCallback = callback;
-    cb_user_data.ChainCallbackUserData = user_data;
-    cb_user_data.luainspector_ptr = this;
-    return ImGui::InputText(label, (char*)str->c_str(), str->capacity() + 1, flags, command_line_callback_st, &cb_user_data);
+void luainspector_heap_snapshot::clear() {
+    objects.clear();
+    edges.clear();
+    edge_labels.clear();
+    labels.clear();
+    by_ptr.clear();
+    total_size = 0;
+    m_label_index.clear();
 }
 
-void neko::luainspector::show_autocomplete() noexcept {
-    constexpr ImGuiWindowFlags overlay_flags = ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_AlwaysAutoResize |
-                                               ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoSavedSettings;
+std::uint32_t luainspector_heap_snapshot::intern_label(const char* text, std::size_t len) {
+    const std::uint64_t key = neko_hash_str(text, len) | 1;
+    const std::uint32_t off = static_cast<std::uint32_t>(labels.size());
+    const std::uint32_t found = m_label_index.insert(key, off);
+    if (found != luainspector_ptr_map::kNone) return found;  // a hash collision only costs a wrong label
+    labels.insert(labels.end(), text, text + len);
+    labels.push_back('\0');
+    return off;
+}
 
-    if ((m_input_text_id == ImGui::GetActiveID() || m_should_take_focus) && (!m_current_autocomplete_strings.empty())) {
+static inline std::uint64_t heap_identity(lua_State* L, int idx) {
+    // lua_topointer gives nothing for strings before 5.4, their characters never move and are just as unique
+    if (lua_type(L, idx) == LUA_TSTRING) return reinterpret_cast<std::uintptr_t>(lua_tostring(L, idx));
+    return reinterpret_cast<std::uintptr_t>(lua_topointer(L, idx));
+}
+
+bool luainspector_heap_snapshot::capture(lua_State* L) {
+    clear();
+    if (!lua_checkstack(L, 8)) return false;
+    const int top = lua_gettop(L);
+
+    lua_newtable(L);  // queue: object i waits in queue[i + 1] until it is walked
+    const int queue = lua_gettop(L);
+
+    constexpr std::uint32_t kOwn = 0xfffffffeu;
+    luainspector_ptr_map seen;
+    seen.insert(heap_identity(L, queue), kOwn);  // the queue is ours, not part of the heap
+
+    const std::uint32_t key_label = intern_label("(key)", 5);
+    const std::uint32_t meta_label = intern_label("(metatable)", 11);
+    const std::uint32_t func_label = intern_label("(function)", 10);
+    const std::uint32_t stack_label = intern_label("(stack)", 7);
+    const std::uint32_t number_label = intern_label("[number]", 8);
+    char buf[128];
+
+    std::uint32_t current = kNoObject;
+    auto visit = [&](int idx, std::uint32_t label) {
+        const int t = lua_type(L, idx);
+        if (t != LUA_TSTRING && t != LUA_TTABLE && t != LUA_TFUNCTION && t != LUA_TUSERDATA && t != LUA_TTHREAD) return;
+        const std::uint64_t id = heap_identity(L, idx);
+        if (id == 0) return;
+
+        const std::uint32_t index = static_cast<std::uint32_t>(objects.size());
+        std::uint32_t found = seen.insert(id, index);
+        if (found == luainspector_ptr_map::kNone) {
+            found = index;
+            std::size_t size = 0;
+            if (t == LUA_TSTRING) {
+                lua_tolstring(L, idx, &size);
+                size += 24;  // strings have no edges and are never queued
+            } else {
+                lua_pushvalue(L, idx);
+                lua_rawseti(L, queue, static_cast<lua_Integer>(index) + 1);
+            }
+            objects.push_back({id, static_cast<std::uint32_t>(std::min<std::size_t>(size, 0xffffffffu)), current, label & ~kWeakEdge, 0, static_cast<std::uint8_t>(t), 0});
+        }
+        if (found != kOwn && current != kNoObject) {
+            edges.push_back(found);
+            edge_labels.push_back(label);
+        }
+    };
+    auto name_label = [&](const char* fmt, const char* name) {
+        const int len = std::snprintf(buf, sizeof(buf), fmt, name);
+        return intern_label(buf, static_cast<std::size_t>(std::min<int>(len, sizeof(buf) - 1)));
+    };
+
+    lua_pushvalue(L, LUA_REGISTRYINDEX);
+    visit(-1, intern_label("registry", 8));
+    lua_pop(L, 1);
+
+    for (std::uint32_t i = 0; i < objects.size(); ++i) {
+        objects[i].edge_begin = static_cast<std::uint32_t>(edges.size());
+        if (objects[i].type == LUA_TSTRING) {
+            total_size += objects[i].size;
+            continue;
+        }
+        current = i;
+        lua_rawgeti(L, queue, static_cast<lua_Integer>(i) + 1);
+        lua_pushnil(L);
+        lua_rawseti(L, queue, static_cast<lua_Integer>(i) + 1);  // the heap keeps it alive from here on
+        const int obj = lua_gettop(L);
+        std::size_t size = 0;
+
+        if (lua_getmetatable(L, obj)) {
+            visit(-1, meta_label);
+            if (objects[i].type == LUA_TTABLE) {
+                lua_pushliteral(L, "__mode");
+                lua_rawget(L, -2);
+                if (const char* mode = lua_tostring(L, -1)) {
+                    if (std::strchr(mode, 'k')) objects[i].flags |= kWeakKeys;
+                    if (std::strchr(mode, 'v')) objects[i].flags |= kWeakValues;
+                }
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+
+        switch (objects[i].type) {
+            case LUA_TTABLE: {
+                const std::size_t array = lua_rawlen(L, obj);
+                const std::uint32_t weak_keys = objects[i].flags & kWeakKeys ? kWeakEdge : 0;
+                const std::uint32_t weak_values = objects[i].flags & kWeakValues ? kWeakEdge : 0;
+                std::size_t count = 0;
+                lua_pushnil(L);
+                while (lua_next(L, obj)) {
+                    ++count;
+                    std::uint32_t label;
+                    if (lua_type(L, -2) == LUA_TSTRING) {
+                        std::size_t len;
+                        const char* key = lua_tolstring(L, -2, &len);
+                        label = intern_label(key, std::min<std::size_t>(len, 64));
+                    } else if (lua_type(L, -2) == LUA_TNUMBER && lua_isinteger(L, -2) && lua_tointeger(L, -2) >= 0 && lua_tointeger(L, -2) <= kLabelMask) {
+                        label = kIndexLabel | static_cast<std::uint32_t>(lua_tointeger(L, -2));
+                    } else {
+                        label = lua_type(L, -2) == LUA_TNUMBER ? number_label : key_label;
+                    }
+                    // Regular objects never hold an entry with a nil key or value, so visiting cannot upset lua_next
+                    visit(-1, label | weak_values);
+                    visit(-2, key_label | weak_keys);
+                    lua_pop(L, 1);
+                }
+                size = 56 + 16 * array + 32 * (count - std::min(count, array));
+                break;
+            }
+            case LUA_TFUNCTION: {
+                int n = 1;
+                for (const char* name; (name = lua_getupvalue(L, obj, n)) != nullptr; ++n) {
+                    visit(-1, *name ? name_label("(upvalue %s)", name) : name_label("(upvalue)", ""));
+                    lua_pop(L, 1);
+                }
+                size = 40 + 16 * static_cast<std::size_t>(n - 1);
+                break;
+            }
+            case LUA_TUSERDATA: {
+#if LUA_VERSION_NUM >= 504
+                for (int n = 1; lua_getiuservalue(L, obj, n) != LUA_TNONE; ++n) {
+                    visit(-1, name_label("(uservalue)", ""));
+                    lua_pop(L, 1);
+                }
+                lua_pop(L, 1);
+#else
+                lua_getuservalue(L, obj);
+                visit(-1, name_label("(uservalue)", ""));
+                lua_pop(L, 1);
+#endif
+                size = 40 + lua_rawlen(L, obj);
+                break;
+            }
+            case LUA_TTHREAD: {
+                lua_State* co = lua_tothread(L, obj);
+                // Values are copied over from co, or pushed right here when walking the running thread itself
+                auto take = [&](std::uint32_t label) {
+                    if (co != L) lua_xmove(co, L, 1);
+                    visit(-1, label);
+                    lua_pop(L, 1);
+                };
+                lua_Debug ar;
+                int level = 0;
+                for (; lua_getstack(co, level, &ar); ++level) {
+                    if (co != L && !lua_checkstack(co, 2)) break;
+                    lua_getinfo(co, "f", &ar);
+                    take(func_label);
+                    for (int n = 1; const char* name = lua_getlocal(co, &ar, n); ++n) take(name_label("(local %s)", name));
+                    for (int n = -1; lua_getlocal(co, &ar, n); --n) take(name_label("(vararg)", ""));
+                }
+                // A coroutine that never ran has its body and arguments on the stack but no frame
+                if (co != L && level == 0 && lua_checkstack(co, 1)) {
+                    for (int n = 1; n <= lua_gettop(co); ++n) {
+                        lua_pushvalue(co, n);
+                        take(stack_label);
+                    }
+                }
+                size = 200 + 16 * static_cast<std::size_t>(lua_gettop(co));
+                break;
+            }
+        }
+
+        objects[i].size = static_cast<std::uint32_t>(std::min<std::size_t>(size, 0xffffffffu));
+        total_size += objects[i].size;
+        lua_pop(L, 1);
+    }
+    current = kNoObject;
+    lua_settop(L, top);
+    m_label_index.clear();
+
+    by_ptr.resize(objects.size());
+    for (std::uint32_t i = 0; i < objects.size(); ++i) by_ptr[i] = i;
+    std::sort(by_ptr.begin(), by_ptr.end(), [this](std::uint32_t a, std::uint32_t b) { return objects[a].ptr < objects[b].ptr; });
+    objects.shrink_to_fit();
+    edges.shrink_to_fit();
+    edge_labels.shrink_to_fit();
+    labels.shrink_to_fit();
+    return true;
+}
+
+std::uint32_t luainspector_heap_snapshot::find(std::uint64_t ptr) const {
+    auto it = std::lower_bound(by_ptr.begin(), by_ptr.end(), ptr, [this](std::uint32_t i, std::uint64_t p) { return objects[i].ptr < p; });
+    return it != by_ptr.end() && objects[*it].ptr == ptr ? *it : kNoObject;
+}
+
+std::size_t luainspector_heap_snapshot::format_label(std::uint32_t from, std::uint32_t label, char* buf, std::size_t size, bool generic) const {
+    const char* text;
+    char index[32];
+    if (label & kIndexLabel) {
+        const std::uint32_t n = label & kLabelMask;
+        if (from == 0 && n == LUA_RIDX_GLOBALS) {
+            text = "_G";
+        } else if (from == 0 && n == LUA_RIDX_MAINTHREAD) {
+            text = "(main thread)";
+        } else if (generic) {
+            text = "[]";
+        } else {
+            std::snprintf(index, sizeof(index), "[%u]", n);
+            text = index;
+        }
+    } else {
+        text = labels.data() + (label & kLabelMask);
+    }
+    const std::size_t len = std::strlen(text);
+    if (size > 0) {
+        const std::size_t n = std::min(len, size - 1);
+        std::memcpy(buf, text, n);
+        buf[n] = '\0';
+    }
+    return len;
+}
+
+std::size_t luainspector_heap_snapshot::path(std::uint32_t i, char* buf, std::size_t size, bool generic) const {
+    // The registry itself is left out, paths start at its keys: _G.player, _LOADED.string, ...
+    constexpr int kMaxParts = 64;
+    std::uint32_t parts[kMaxParts];
+    int count = 0;
+    bool cut = false;
+    for (std::uint32_t n = i; n != kNoObject && objects[n].parent != kNoObject; n = objects[n].parent) {
+        if (count == kMaxParts) {
+            cut = true;
+            break;
+        }
+        parts[count++] = n;
+    }
+
+    std::size_t len = 0;
+    auto append = [&](const char* str, std::size_t n) {
+        for (std::size_t k = 0; k < n; ++k, ++len) {
+            if (len + 1 < size) buf[len] = str[k];
+        }
+    };
+    if (cut) append("...", 3);
+    if (count == 0) append("registry", 8);
+    char label[128];
+    for (int k = count - 1; k >= 0; --k) {
+        const object& o = objects[parts[k]];
+        const std::size_t n = std::min(format_label(o.parent, o.label, label, sizeof(label), generic), sizeof(label) - 1);
+        if ((k != count - 1 || cut) && label[0] != '[') append(".", 1);
+        append(label, n);
+    }
+    if (size > 0) buf[std::min(len, size - 1)] = '\0';
+    return len;
+}
+
+// File layout: magic, counts, then the arrays as they are in memory
+static constexpr std::uint32_t kHeapSnapshotMagic = 0x32414548u;  // "HEA2"
+
+bool luainspector_heap_snapshot::save(const char* file) const {
+    std::ofstream out(file, std::ios::binary);
+    if (!out) return false;
+    const std::uint64_t header[5] = {kHeapSnapshotMagic | static_cast<std::uint64_t>(sizeof(object)) << 32, objects.size(), edges.size(), labels.size(), total_size};
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(objects.data()), static_cast<std::streamsize>(objects.size() * sizeof(object)));
+    out.write(reinterpret_cast<const char*>(edges.data()), static_cast<std::streamsize>(edges.size() * sizeof(std::uint32_t)));
+    out.write(reinterpret_cast<const char*>(edge_labels.data()), static_cast<std::streamsize>(edge_labels.size() * sizeof(std::uint32_t)));
+    out.write(labels.data(), static_cast<std::streamsize>(labels.size()));
+    out.write(reinterpret_cast<const char*>(by_ptr.data()), static_cast<std::streamsize>(by_ptr.size() * sizeof(std::uint32_t)));
+    return static_cast<bool>(out);
+}
+
+bool luainspector_heap_snapshot::load(const char* file) {
+    clear();
+    std::ifstream in(file, std::ios::binary);
+    std::uint64_t header[5];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+    if (header[0] != (kHeapSnapshotMagic | static_cast<std::uint64_t>(sizeof(object)) << 32)) return false;
+    objects.resize(header[1]);
+    edges.resize(header[2]);
+    edge_labels.resize(header[2]);
+    labels.resize(header[3]);
+    by_ptr.resize(header[1]);
+    total_size = header[4];
+    in.read(reinterpret_cast<char*>(objects.data()), static_cast<std::streamsize>(objects.size() * sizeof(object)));
+    in.read(reinterpret_cast<char*>(edges.data()), static_cast<std::streamsize>(edges.size() * sizeof(std::uint32_t)));
+    in.read(reinterpret_cast<char*>(edge_labels.data()), static_cast<std::streamsize>(edge_labels.size() * sizeof(std::uint32_t)));
+    in.read(labels.data(), static_cast<std::streamsize>(labels.size()));
+    in.read(reinterpret_cast<char*>(by_ptr.data()), static_cast<std::streamsize>(by_ptr.size() * sizeof(std::uint32_t)));
+    if (!in) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+void luainspector_heap_diff::compute(const luainspector_heap_snapshot& before, const luainspector_heap_snapshot& after) {
+    groups.clear();
+    text.clear();
+    std::unordered_map<std::uint64_t, std::uint32_t> index;  // hash of type and path -> group
+    char buf[1024];
+
+    auto group_of = [&](const luainspector_heap_snapshot& snap, std::uint32_t i) -> group& {
+        const std::size_t len = std::min(snap.path(i, buf, sizeof(buf), true), sizeof(buf) - 1);
+        const std::uint8_t type = snap.objects[i].type;
+        const std::uint64_t key = neko_hash_str(buf, len, neko_hash_str(reinterpret_cast<const char*>(&type), 1));
+        auto [it, inserted] = index.emplace(key, static_cast<std::uint32_t>(groups.size()));
+        if (inserted) {
+            groups.push_back({static_cast<std::uint32_t>(text.size()), static_cast<std::uint32_t>(len), type, 0, 0, 0, 0, 0, 0});
+            text.insert(text.end(), buf, buf + len);
+        }
+        return groups[it->second];
+    };
+
+    // Both sides are ordered by identity, one merge pass pairs them up
+    std::size_t a = 0, b = 0;
+    while (a < before.by_ptr.size() || b < after.by_ptr.size()) {
+        const luainspector_heap_snapshot::object* oa = a < before.by_ptr.size() ? &before.objects[before.by_ptr[a]] : nullptr;
+        const luainspector_heap_snapshot::object* ob = b < after.by_ptr.size() ? &after.objects[after.by_ptr[b]] : nullptr;
+        if (oa && (!ob || oa->ptr < ob->ptr)) {
+            group& g = group_of(before, before.by_ptr[a++]);
+            ++g.freed_count;
+            g.freed_bytes += oa->size;
+        } else if (ob && (!oa || ob->ptr < oa->ptr || oa->type != ob->type)) {
+            if (oa && oa->ptr == ob->ptr) {
+                // Same address, different type: the old object is gone and a new one took its place
+                group& g = group_of(before, before.by_ptr[a++]);
+                ++g.freed_count;
+                g.freed_bytes += oa->size;
+            }
+            group& g = group_of(after, after.by_ptr[b++]);
+            ++g.new_count;
+            g.new_bytes += ob->size;
+        } else {
+            if (oa->size != ob->size) {
+                group& g = group_of(after, after.by_ptr[b]);
+                ++g.grown_count;
+                g.grown_bytes += static_cast<std::int64_t>(ob->size) - static_cast<std::int64_t>(oa->size);
+            }
+            ++a;
+            ++b;
+        }
+    }
+
+    std::sort(groups.begin(), groups.end(), [](const group& x, const group& y) { return x.new_bytes + x.grown_bytes - x.freed_bytes > y.new_bytes + y.grown_bytes - y.freed_bytes; });
+}
+
+bool luainspector_retention_index::build(lua_State* L) {
+    if (!snapshot.capture(L)) return false;
+    const std::size_t n = snapshot.objects.size();
+
+    m_index.clear();
+    m_index.reserve(n);
+    m_globals = luainspector_heap_snapshot::kNoObject;
+    for (std::uint32_t i = 0; i < n; ++i) {
+        const luainspector_heap_snapshot::object& o = snapshot.objects[i];
+        m_index.insert(o.ptr, i);
+        if (o.parent == 0 && o.label == (luainspector_heap_snapshot::kIndexLabel | LUA_RIDX_GLOBALS)) m_globals = i;
+    }
+
+    // Counting sort of the strong edges by target
+    ref_begin.assign(n + 1, 0);
+    for (std::size_t e = 0; e < snapshot.edges.size(); ++e) {
+        if (!(snapshot.edge_labels[e] & luainspector_heap_snapshot::kWeakEdge)) ++ref_begin[snapshot.edges[e] + 1];
+    }
+    for (std::size_t i = 0; i < n; ++i) ref_begin[i + 1] += ref_begin[i];
+    referrers.resize(ref_begin[n]);
+    ref_labels.resize(ref_begin[n]);
+    m_queue.assign(ref_begin.begin(), ref_begin.end() - 1);  // fill cursors
+    for (std::uint32_t from = 0; from < n; ++from) {
+        for (std::uint32_t e = snapshot.objects[from].edge_begin; e < snapshot.edge_end(from); ++e) {
+            if (snapshot.edge_labels[e] & luainspector_heap_snapshot::kWeakEdge) continue;
+            const std::uint32_t at = m_queue[snapshot.edges[e]]++;
+            referrers[at] = from;
+            ref_labels[at] = snapshot.edge_labels[e];
+        }
+    }
+
+    m_stamp.assign(n, 0);
+    m_next.resize(n);
+    m_next_label.resize(n);
+    m_queue.clear();
+    m_epoch = 0;
+    return true;
+}
+
+void luainspector_retention_index::retainers(std::uint32_t target, std::size_t max_paths, std::vector<step>& steps, std::vector<std::uint32_t>& path_begin) {
+    steps.clear();
+    path_begin.clear();
+    if (target >= snapshot.objects.size()) return;
+
+    for (std::uint32_t r = ref_begin[target]; r < ref_begin[target + 1] && path_begin.size() < max_paths; ++r) {
+        const std::uint32_t owner = referrers[r];
+        if (owner == target) continue;
+
+        if (++m_epoch == 0) {
+            std::fill(m_stamp.begin(), m_stamp.end(), 0);
+            m_epoch = 1;
+        }
+        // Breadth-first towards the roots, never through the target itself
+        m_stamp[target] = m_stamp[owner] = m_epoch;
+        m_next[owner] = target;
+        m_next_label[owner] = ref_labels[r];
+        m_queue.clear();
+        m_queue.push_back(owner);
+        std::uint32_t root = is_root(owner) ? owner : luainspector_heap_snapshot::kNoObject;
+        for (std::size_t head = 0; head < m_queue.size() && root == luainspector_heap_snapshot::kNoObject; ++head) {
+            const std::uint32_t u = m_queue[head];
+            for (std::uint32_t k = ref_begin[u]; k < ref_begin[u + 1]; ++k) {
+                const std::uint32_t p = referrers[k];
+                if (m_stamp[p] == m_epoch) continue;
+                m_stamp[p] = m_epoch;
+                m_next[p] = u;
+                m_next_label[p] = ref_labels[k];
+                if (is_root(p)) {
+                    root = p;
+                    break;
+                }
+                m_queue.push_back(p);
+            }
+        }
+        if (root == luainspector_heap_snapshot::kNoObject) continue;  // only held through the target, a cycle
+
+        path_begin.push_back(static_cast<std::uint32_t>(steps.size()));
+        std::uint32_t label = luainspector_heap_snapshot::kNoObject;
+        for (std::uint32_t i = root;; i = m_next[i]) {
+            steps.push_back({i, label});
+            if (i == target) break;
+            label = m_next_label[i];
+        }
+    }
+    path_begin.push_back(static_cast<std::uint32_t>(steps.size()));
+}
+
+}  // namespace neko
+
+const char* const kMetaname = "__neko_lua_inspector_meta";
+
+static void* __neko_lua_inspector_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_command_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_chunks_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_watch_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_edits_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_print_func_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+neko::luainspector* neko::luainspector::get_from_registry(lua_State* L) {
+    lua_pushlightuserdata(L, __neko_lua_inspector_lightkey());  // # -1
+    lua_gettable(L, LUA_REGISTRYINDEX);
+
+    neko::luainspector* ret = nullptr;
+
+    if (lua_type(L, -1) == LUA_TUSERDATA && lua_getmetatable(L, -1)) {
+        // # -1 = metatable
+        // # -2 = userdata
+        lua_getfield(L, LUA_REGISTRYINDEX, kMetaname);  // get inspector metatable from registry
+        // # -1 = metatable
+        // # -2 = metatable
+        // # -3 = userdata
+        if (neko_lua_equal(L, -1, -2)) {                                      // determine is two metatable equal
+            ret = *static_cast<neko::luainspector**>(lua_touserdata(L, -3));  // inspector userdata
+        }
+
+        lua_pop(L, 2);  // pop two
+    }
+
+    lua_pop(L, 1);  // pop inspector userdata
+    return ret;
+}
+
+void neko::luainspector::print_luastack(int first, int last, luainspector_logtype logtype) {
+    m_line_buffer.clear();
+    char buf[64];
+    for (int i = first; i <= last; ++i) {
+        std::size_t len;
+        switch (lua_type(L, i)) {
+            case LUA_TNUMBER:
+            case LUA_TSTRING: {
+                const bool quote = lua_type(L, i) == LUA_TSTRING;
+                const char* str = lua_tolstring(L, i, &len);
+                if (quote) m_line_buffer += '\'';
+                m_line_buffer.append(str, len);
+                if (quote) m_line_buffer += '\'';
+                break;
+            }
+            case LUA_TBOOLEAN:
+                m_line_buffer += lua_toboolean(L, i) ? "true" : "false";
+                break;
+            case LUA_TNIL:
+                m_line_buffer += "nil";
+                break;
+            default: {
+                const int n = std::snprintf(buf, sizeof(buf), "%s: %p", luaL_typename(L, i), lua_topointer(L, i));
+                m_line_buffer.append(buf, std::min(static_cast<std::size_t>(std::max(n, 0)), sizeof(buf) - 1));
+                break;
+            }
+        }
+        m_line_buffer += ' ';
+    }
+    print_line(m_line_buffer, logtype);
+}
+
+struct luainspector_chunk_reader {
+    std::string_view parts[2];
+    int next;
+};
+
+static const char* __luainspector_read_chunk(lua_State*, void* ud, size_t* size) {
+    luainspector_chunk_reader* reader = static_cast<luainspector_chunk_reader*>(ud);
+    while (reader->next < 2) {
+        const std::string_view part = reader->parts[reader->next++];
+        if (!part.empty()) {
+            *size = part.size();
+            return part.data();
+        }
+    }
+    *size = 0;
+    return nullptr;
+}
+
+// Compile code, as "return <code>" with addreturn. The prefix is fed to the parser as a piece of its own rather
+// than concatenated. Leaves the function on success, the error message otherwise except with addreturn.
+bool neko::luainspector::try_eval(std::string_view code, bool addreturn) {
+    luainspector_chunk_reader reader{{addreturn ? std::string_view("return ") : std::string_view(), code}, 0};
+    if (LUA_OK == lua_load(L, &__luainspector_read_chunk, &reader, "=console", nullptr)) return true;
+    if (addreturn) lua_pop(L, 1);  // pop error
+    return false;
+}
+
+// Push the compiled function for a console command. A command seen before is taken from the chunk cache
+// without parsing, a new one is compiled as an expression, then as a statement if that fails, and cached.
+bool neko::luainspector::load_command(std::string_view code) {
+    const std::uint64_t hash = neko_hash_str(code.data(), code.size());
+    ++m_chunk_tick;
+
+    lua_pushlightuserdata(L, __neko_lua_inspector_chunks_lightkey());
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_type(L, -1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_createtable(L, static_cast<int>(kChunkCacheSize), 0);
+        lua_pushlightuserdata(L, __neko_lua_inspector_chunks_lightkey());
+        lua_pushvalue(L, -2);
+        lua_rawset(L, LUA_REGISTRYINDEX);
+        m_chunk_cache.clear();
+    }
+    const int chunks = lua_gettop(L);
+
+    for (std::size_t i = 0; i < m_chunk_cache.size(); ++i) {
+        if (m_chunk_cache[i].hash != hash || m_chunk_cache[i].source != code) continue;
+        m_chunk_cache[i].used = m_chunk_tick;
+        lua_rawgeti(L, chunks, static_cast<lua_Integer>(i) + 1);
+        lua_remove(L, chunks);
+        return true;
+    }
+
+    if (!try_eval(code, true) && !try_eval(code, false)) {
+        lua_remove(L, chunks);  // leaves the error
+        return false;
+    }
+
+    // A free slot, or the least recently used one
+    std::size_t slot = m_chunk_cache.size();
+    if (slot < kChunkCacheSize) {
+        m_chunk_cache.emplace_back();
+    } else {
+        slot = 0;
+        for (std::size_t i = 1; i < m_chunk_cache.size(); ++i) {
+            if (m_chunk_cache[i].used < m_chunk_cache[slot].used) slot = i;
+        }
+    }
+    m_chunk_cache[slot].hash = hash;
+    m_chunk_cache[slot].used = m_chunk_tick;
+    m_chunk_cache[slot].source.assign(code);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, chunks, static_cast<lua_Integer>(slot) + 1);
+    lua_remove(L, chunks);
+    return true;
+}
+
+// Avoid error when calling with non-strings
+static inline std::string_view adjust_error_msg(lua_State* L, int idx, char* buf, std::size_t size) {
+    const int t = lua_type(L, idx);
+    if (t == LUA_TSTRING) {
+        std::size_t len;
+        const char* str = lua_tolstring(L, idx, &len);
+        return {str, len};
+    }
+    const int n = std::snprintf(buf, size, "(non string error value - %s)", lua_typename(L, t));
+    return {buf, std::min(static_cast<std::size_t>(std::max(n, 0)), size - 1)};
+}
+
+void neko::luainspector::setL(lua_State* L) {
+    if (this->L != L) {
+        // Neither the allocator nor the hook may outlive the inspector
+        if (m_command) end_command();
+        m_chunk_cache.clear();  // its functions live in the old state
+        m_edits.clear();
+        for (luainspector_watch& w : m_watches) w.compiled = false;
+        m_memprof.uninstall();
+        m_profiler.stop();
+        if (this->L && lua_gethook(this->L) == &hook) lua_sethook(this->L, nullptr, 0, 0);
+    }
+    this->L = L;
+
+    if (!L) return;
+
+    neko::luainspector** ptr = static_cast<neko::luainspector**>(lua_newuserdata(L, sizeof(neko::luainspector*)));
+    (*ptr) = this;
+
+    luaL_newmetatable(L, kMetaname);  // table
+    lua_pushliteral(L, "__gc");
+    lua_pushcfunction(L, &__luainspector_gc);
+    lua_settable(L, -3);  // table[gc]=ConsoleModel_gc
+    lua_setmetatable(L, -2);
+
+    lua_pushlightuserdata(L, __neko_lua_inspector_lightkey());
+    lua_pushvalue(L, -2);
+    lua_settable(L, LUA_REGISTRYINDEX);
+
+    lua_pushvalue(L, -1);
+    lua_pushcclosure(L, &__luainspector_echo, 1);
+    lua_setglobal(L, "echo");
+
+    if (luaL_loadbuffer(L, kBenchSource, sizeof(kBenchSource) - 1, "=luainspector.bench") == LUA_OK) {
+        lua_pushvalue(L, -2);
+        lua_pushcclosure(L, &__luainspector_command_stats, 1);
+        lua_getglobal(L, "echo");
+        if (lua_pcall(L, 2, 1, 0) == LUA_OK) lua_setglobal(L, "bench");
+    }
+    if (lua_type(L, -1) == LUA_TSTRING) lua_pop(L, 1);  // load or run error, bench is left out
+
+    // profiler.start([period [, interval_us]]), profiler.stop(), profiler.reset(), profiler.save([path])
+    static const luaL_Reg profiler_funcs[] = {
+            {"start", __luainspector_profiler_start}, {"stop", __luainspector_profiler_stop}, {"reset", __luainspector_profiler_reset}, {"save", __luainspector_profiler_save}, {nullptr, nullptr}};
+    lua_newtable(L);
+    lua_insert(L, -2);
+    luaL_setfuncs(L, profiler_funcs, 1);
+    lua_setglobal(L, "profiler");
+}
+
+// Lua keeps a single hook per thread, the memory and CPU profilers share this one. Returns false when a
+// hook set by someone else is in the way.
+bool neko::luainspector::update_hook() {
+    if (!L) return false;
+    int count = 0;
+    if (m_profiler.running()) count = m_profiler.period;
+    // Installed only to meter a command, the allocator counters are enough and the main state is left alone
+    if (m_memprof.installed() && !m_command_owns_memprof) count = count ? std::min(count, luainspector_memprof::kHookCount) : luainspector_memprof::kHookCount;
+
+    // The command coroutine has a hook of its own, which also watches its frame budget
+    if (m_command) lua_sethook(m_command, &hook, LUA_MASKCOUNT, count ? std::min(count, kCommandHookCount) : kCommandHookCount);
+
+    const lua_Hook current = lua_gethook(L);
+    if (current && current != &hook) return count == 0;
+    if (count > 0) {
+        lua_sethook(L, &hook, LUA_MASKCOUNT, count);
+    } else if (current) {
+        lua_sethook(L, nullptr, 0, 0);
+    }
+    return true;
+}
+
+void neko::luainspector::hook(lua_State* L, lua_Debug* ar) {
+    if (ar->event != LUA_HOOKCOUNT) return;
+    lua_rawgetp(L, LUA_REGISTRYINDEX, __neko_lua_inspector_lightkey());
+    neko::luainspector** ptr = static_cast<neko::luainspector**>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    if (!ptr || !*ptr) return;
+    luainspector* self = *ptr;
+    self->m_profiler.on_count_hook(L);
+    self->m_memprof.on_count_hook(L, ar);
+
+    if (L == self->m_command) self->m_command_stats.instructions += static_cast<std::uint64_t>(lua_gethookcount(L));
+
+    // A console command hands the frame back once its budget is spent. Inside a C call that cannot be
+    // yielded across (a sort comparator, a metamethod on 5.3) it runs on until the next yieldable hook.
+    if (L == self->m_command && lua_isyieldable(L) && std::chrono::steady_clock::now() >= self->m_command_deadline) {
+        self->m_command_hook_yield = true;
+        lua_yield(L, 0);
+    }
+}
+
+// Compile cmd and start it as a coroutine, the first slice runs right away
+void neko::luainspector::start_command() {
+    const int oldtop = lua_gettop(L);
+    if (!load_command(cmd)) {
+        char buf[64];
+        const std::string_view err = adjust_error_msg(L, -1, buf, sizeof(buf));
+        if (!neko::incomplete_chunk_error(err.data(), err.length())) print_line(err, LUACON_LOG_TYPE_ERROR);
+        lua_settop(L, oldtop);
+        return;
+    }
+
+    lua_pushlightuserdata(L, __neko_lua_inspector_command_lightkey());
+    lua_State* co = lua_newthread(L);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    lua_xmove(L, co, 1);  // the chunk
+    lua_settop(L, oldtop);
+
+    m_command = co;
+    m_command_started = ImGui::GetTime();
+    m_command_stats = {};
+    ++m_command_serial;
+
+    // Allocations are metered through the memory profiler, installed for the command when it is not already
+    m_command_owns_memprof = !m_memprof.installed() && m_memprof.install(L, true);
+
+    // Completed collections are counted by a chain of sentinels, each one finalized by the next collection
+    lua_newuserdata(L, 0);
+    lua_newtable(L);
+    lua_pushliteral(L, "__gc");
+    lua_pushlightuserdata(L, __neko_lua_inspector_lightkey());
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_pushinteger(L, m_command_serial);
+    lua_pushcclosure(L, &__luainspector_gc_sentinel, 2);
+    lua_rawset(L, -3);
+    lua_setmetatable(L, -2);
+    lua_pop(L, 1);
+
+    if (!update_hook()) print_line("command: another hook is installed on this state, the profilers do not sample it", LUACON_LOG_TYPE_WARNING);
+    resume_command();
+}
+
+// Run the command for at most command_budget_us, then print its results or error if it ended
+void neko::luainspector::resume_command() {
+    if (m_command_resuming) return;  // the command drew the inspector itself
+    lua_State* co = m_command;
+    m_command_deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(command_budget_us);
+    m_command_hook_yield = false;
+
+    m_command_slice_start = std::chrono::steady_clock::now();
+    m_command_allocated_mark = m_memprof.allocated_bytes();
+    m_command_freed_mark = m_memprof.freed_bytes();
+
+    m_command_resuming = true;
+    int nres;
+#if LUA_VERSION_NUM >= 504
+    const int status = lua_resume(co, L, 0, &nres);
+#else
+    const int status = lua_resume(co, L, 0);
+    nres = status == LUA_YIELD && m_command_hook_yield ? 0 : lua_gettop(co);
+#endif
+    m_command_stats = command_stats();
+    ++m_command_stats.slices;
+    m_command_resuming = false;
+
+    if (status == LUA_YIELD) {
+        lua_pop(co, nres);  // values of a coroutine.yield() at the top level of the command are dropped
+        return;
+    }
+
+    if (status == LUA_OK) {
+        const int oldtop = lua_gettop(L);
+        if (nres > 0 && lua_checkstack(L, nres)) {
+            lua_xmove(co, L, nres);
+            print_luastack(oldtop + 1, lua_gettop(L), LUACON_LOG_TYPE_MESSAGE);
+            lua_settop(L, oldtop);
+        }
+    } else {
+        char buf[64];
+        print_line(adjust_error_msg(co, -1, buf, sizeof(buf)), LUACON_LOG_TYPE_ERROR);
+    }
+
+    const luainspector_command_stats& stats = m_command_stats;
+    char line[256];
+    int n = std::snprintf(line, sizeof(line), "-- %.3f ms in %u frame%s, ~%llu instructions, ", stats.us / 1000.0, stats.slices, stats.slices == 1 ? "" : "s",
+                          static_cast<unsigned long long>(stats.instructions));
+    n += std::snprintf(line + n, sizeof(line) - n, m_memprof.installed() ? "%llu bytes allocated, %llu freed, " : "allocations not metered, ", static_cast<unsigned long long>(stats.allocated),
+                       static_cast<unsigned long long>(stats.freed));
+    std::snprintf(line + n, sizeof(line) - n, "%u GC cycle%s", stats.gc_cycles, stats.gc_cycles == 1 ? "" : "s");
+    print_line(line, LUACON_LOG_TYPE_NOTE);
+    end_command();
+}
+
+// The running command's totals, including the slice in progress. Called from anywhere else only the clock and,
+// with the memory profiler on, the allocator totals are read, which is still enough for differences.
+neko::luainspector_command_stats neko::luainspector::command_stats() const {
+    if (!m_command_resuming) {
+        luainspector_command_stats now{};
+        now.us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        now.allocated = m_memprof.allocated_bytes();
+        now.freed = m_memprof.freed_bytes();
+        return now;
+    }
+    luainspector_command_stats stats = m_command_stats;
+    stats.us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_command_slice_start).count();
+    stats.allocated += m_memprof.allocated_bytes() - m_command_allocated_mark;
+    stats.freed += m_memprof.freed_bytes() - m_command_freed_mark;
+    return stats;
+}
+
+// A GC sentinel of command serial was finalized, false once that command has ended so the chain stops
+bool neko::luainspector::command_gc_cycle(std::uint32_t serial) {
+    if (!m_command || serial != m_command_serial) return false;
+    if (m_command_resuming) ++m_command_stats.gc_cycles;  // collections the game ran in between are not the command's
+    return true;
+}
+
+void neko::luainspector::cancel_command() {
+    if (!m_command || m_command_resuming) return;
+#if LUA_VERSION_NUM >= 504
+    lua_resetthread(m_command);  // runs pending __close handlers
+#endif
+    print_line("Command cancelled", LUACON_LOG_TYPE_WARNING);
+    end_command();
+}
+
+void neko::luainspector::end_command() {
+    if (m_command_owns_memprof) {
+        m_memprof.uninstall();
+        m_command_owns_memprof = false;
+        update_hook();
+    }
+    lua_pushlightuserdata(L, __neko_lua_inspector_command_lightkey());
+    lua_pushnil(L);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    m_command = nullptr;
+    m_completion_ranked.clear();
+    m_completion_generation++;  // the command may have changed any table
+}
+
+const std::string& neko::luainspector::read_history(int change) {
+    const bool was_promp = static_cast<std::size_t>(m_hindex) == m_history.size();
+
+    m_hindex += change;
+    m_hindex = std::max<int>(m_hindex, 0);
+    m_hindex = std::min<int>(m_hindex, m_history.size());
+
+    if (static_cast<std::size_t>(m_hindex) == m_history.size()) {
+        return m_history[m_hindex - 1];
+    } else {
+        return m_history[m_hindex];
+    }
+}
+
+// Rank the keys of the table the input refers to against its last word. The key list comes from the
+// completion cache, a table is only re-scanned when a command ran since or its entry is older than kCompletionTTL.
+bool neko::luainspector::update_completions(std::string_view inputbuffer, std::string_view& last) {
+    m_completion_entry = nullptr;
+    m_completion_ranked.clear();
+    if (!L) return false;
+
+    const int oldtop = lua_gettop(L);
+    last = luainspector_hints::prepare_hints(L, inputbuffer, m_hint_buffer);
+    if (lua_type(L, -1) != LUA_TTABLE && !luainspector_hints::try_replace_with_metaindex(L)) {
+        lua_settop(L, oldtop);
+        lua_pushglobaltable(L);
+    }
+
+    const void* table = lua_topointer(L, -1);
+    if (m_completion_cache.size() >= kCompletionCacheSize && !m_completion_cache.count(table)) m_completion_cache.clear();
+    luainspector_completion_entry& entry = m_completion_cache[table];
+    if (entry.generation != m_completion_generation || ImGui::GetTime() - entry.time > kCompletionTTL) {
+        luainspector_hints::collect_keys(L, entry);
+        entry.generation = m_completion_generation;
+        entry.time = ImGui::GetTime();
+    }
+    lua_settop(L, oldtop);
+
+    const bool skip_under_score = last.empty();
+    m_completion_scored.clear();
+    for (std::uint32_t i = 0; i < entry.keys.size(); ++i) {
+        const std::string_view key = entry.name(i);
+        if (skip_under_score && !key.empty() && key[0] == '_') continue;
+        const int score = luainspector_hints::fuzzy_score(last, key);
+        if (score >= 0) m_completion_scored.emplace_back(score, i);
+    }
+    // Keys are sorted, so equal scores stay in alphabetical order
+    std::stable_sort(m_completion_scored.begin(), m_completion_scored.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (const auto& scored : m_completion_scored) m_completion_ranked.push_back(scored.second);
+
+    m_completion_entry = &entry;
+    return true;
+}
+
+std::string_view neko::luainspector::try_complete(std::string_view inputbuffer) {
+    if (!L) {
+        print_line("Lua state pointer is NULL, no completion available", LUACON_LOG_TYPE_ERROR);
+        return inputbuffer;
+    }
+
+    std::string_view last;
+    if (!update_completions(inputbuffer, last) || m_completion_ranked.empty()) return inputbuffer;
+    const luainspector_completion_entry& entry = *m_completion_entry;
+
+    std::size_t prefixed = 0;  // prefix matches rank first
+    while (prefixed < m_completion_ranked.size() && entry.name(m_completion_ranked[prefixed]).substr(0, last.size()) == last) ++prefixed;
+
+    std::string& out = m_complete_buffer;
+    out.assign(inputbuffer);
+    if (prefixed == 0u) {
+        // Only fuzzy matches, take the best one in place of the last word
+        const std::string_view best = entry.name(m_completion_ranked[0]);
+        out.replace(out.size() - last.size(), last.size(), best.data(), best.size());
+        m_completion_ranked.clear();
+    } else if (prefixed == 1u) {
+        const std::string_view added = entry.name(m_completion_ranked[0]).substr(last.size());
+        out.append(added.data(), added.size());
+        m_completion_ranked.clear();
+    } else {
+        std::string_view common_prefix = entry.name(m_completion_ranked[0]);
+        for (std::size_t i = 1u; i < prefixed; ++i) {
+            const std::string_view key = entry.name(m_completion_ranked[i]);
+            std::size_t n = 0;
+            while (n < common_prefix.size() && n < key.size() && common_prefix[n] == key[n]) ++n;
+            common_prefix = common_prefix.substr(0, n);
+        }
+        if (common_prefix.size() <= last.size()) {
+            m_line_buffer.assign(entry.name(m_completion_ranked[0]));
+            const std::size_t shown = std::min<std::size_t>(prefixed, 100u);
+            for (std::size_t i = 1u; i < shown; ++i) m_line_buffer.append(" ").append(entry.name(m_completion_ranked[i]));
+            if (shown < prefixed) {
+                char more[32];
+                const int n = std::snprintf(more, sizeof(more), " (+%zu more)", prefixed - shown);
+                m_line_buffer.append(more, std::min(static_cast<std::size_t>(std::max(n, 0)), sizeof(more) - 1));
+            }
+            print_line(m_line_buffer, LUACON_LOG_TYPE_NOTE);
+        } else {
+            const std::string_view added = common_prefix.substr(last.size());
+            out.append(added.data(), added.size());
+            m_completion_ranked.clear();
+        }
+    }
+    return out;
+}
+
+// void neko::luainspector::set_print_eval_prettifier(lua_State* L) {
+//     if (lua_gettop(L) == 0) return;
+
+//     const int t = lua_type(L, -1);
+//     if (!(t == LUA_TFUNCTION || t == LUA_TNIL)) return;
+
+//     lua_pushlightuserdata(L, __neko_lua_inspector_print_func_lightkey());
+//     lua_insert(L, -2);
+//     lua_settable(L, LUA_REGISTRYINDEX);
+// }
+
+// void neko::luainspector::get_print_eval_prettifier(lua_State* L) const {
+//     lua_pushlightuserdata(L, __neko_lua_inspector_print_func_lightkey());
+//     lua_gettable(L, LUA_REGISTRYINDEX);
+// }
+
+// bool neko::luainspector::apply_prettifier(int index) {
+//     get_print_eval_prettifier(L);
+//     if (lua_type(L, -1) == LUA_TNIL) {
+//         lua_pop(L, 1);
+//         return false;
+//     }
+
+//     assert(lua_type(L, -1) == LUA_TFUNCTION);
+//     lua_pushvalue(L, index);
+//     if (LUA_OK == lua_pcall(L, 1, 1, 0)) {
+//         lua_remove(L, index);
+//         lua_insert(L, index);
+//         return true;
+//     } else {
+//         print_line(adjust_error_msg(L, -1), LUACON_LOG_TYPE_ERROR);
+//         lua_pop(L, 1);
+//         return false;
+//     }
+//     return true;
+// }
+
+int neko::luainspector::command_line_callback_st(ImGuiInputTextCallbackData* data) noexcept {
+    command_line_input_callback_UserData* user_data = (command_line_input_callback_UserData*)data->UserData;
+    return reinterpret_cast<neko::luainspector*>(user_data->luainspector_ptr)->command_line_input_callback(data);
+}
+
+int neko::luainspector::command_line_input_callback(ImGuiInputTextCallbackData* data) {
+    command_line_input_callback_UserData* user_data = (command_line_input_callback_UserData*)data->UserData;
+
+    auto paste_buffer = [data](auto begin, auto end, auto buffer_shift) {
+        neko::copy(begin, end, data->Buf + buffer_shift, data->Buf + data->BufSize - 1);
+        data->BufTextLen = std::min(static_cast<int>(std::distance(begin, end) + buffer_shift), data->BufSize - 1);
+        data->Buf[data->BufTextLen] = '\0';
+        data->BufDirty = true;
+        data->SelectionStart = data->SelectionEnd;
+        data->CursorPos = data->BufTextLen;
+    };
+
+    const char* command_beg = nullptr;
+    command_beg = neko::find_terminating_word(cmd.data(), cmd.data() + cmd.size(), [this](std::string_view sv) { return sv[0] == ' ' ? 1 : 0; });
+
+    if (data->EventKey == ImGuiKey_Tab) {
+        const std::string_view complete = this->try_complete(cmd);
+        if (!complete.empty()) {
+            paste_buffer(complete.data(), complete.data() + complete.size(), command_beg - cmd.data());
+            // neko_log_trace("%s", complete.c_str());
+        }
+    }
+    if (data->EventKey == ImGuiKey_UpArrow) {
+        const std::string& entry = this->read_history(-1);
+        paste_buffer(entry.data(), entry.data() + entry.size(), command_beg - cmd.data());
+        // neko_log_trace("h:%s", entry.c_str());
+    }
+    if (data->EventKey == ImGuiKey_DownArrow) {
+        const std::string& entry = this->read_history(1);
+        paste_buffer(entry.data(), entry.data() + entry.size(), command_beg - cmd.data());
+        // neko_log_trace("h:%s", entry.c_str());
+    }
+
+    // Suggestions follow the input as it is typed, served from the completion cache
+    if (data->EventFlag == ImGuiInputTextFlags_CallbackEdit) {
+        std::string_view last;
+        if (data->BufTextLen > 0) {
+            update_completions(std::string_view(data->Buf, data->BufTextLen), last);
+        } else {
+            m_completion_ranked.clear();
+        }
+    }
+
+    if (data->EventFlag == ImGuiInputTextFlags_CallbackResize) {
+        std::string* str = user_data->Str;
+        neko_assert(data->Buf == str->c_str());
+        str->resize(data->BufTextLen);
+        data->Buf = (char*)str->c_str();
+    } else if (user_data->ChainCallback) {
+        data->UserData = user_data->ChainCallbackUserData;
+        return user_data->ChainCallback(data);
+    }
+    return 0;
+}
+
+bool neko::luainspector::command_line_input(const char* label, std::string* str, ImGuiInputTextFlags flags, ImGuiInputTextCallback callback, void* user_data) {
+    IM_ASSERT((flags & ImGuiInputTextFlags_CallbackResize) == 0);
+    flags |= ImGuiInputTextFlags_CallbackResize;
+
+    command_line_input_callback_UserData cb_user_data;
+    cb_user_data.Str = str;
+    cb_user_data.ChainCallback = callback;
+    cb_user_data.ChainCallbackUserData = user_data;
+    cb_user_data.luainspector_ptr = this;
+    return ImGui::InputText(label, (char*)str->c_str(), str->capacity() + 1, flags, command_line_callback_st, &cb_user_data);
+}
+
+void neko::luainspector::show_autocomplete() noexcept {
+    constexpr ImGuiWindowFlags overlay_flags = ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_AlwaysAutoResize |
+                                               ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoSavedSettings;
+
+    if ((m_input_text_id == ImGui::GetActiveID() || m_should_take_focus) && m_completion_entry && (!m_completion_ranked.empty())) {
 
         ImGui::SetNextWindowBgAlpha(0.9f);
         ImGui::PushStyleVar(ImGuiStyleVar_WindowRounding, 0.0f);
         ImGui::SetNextWindowFocus();
 
-        ImVec2 auto_complete_pos = ImGui::GetItemRectMin();
+        ImVec2 auto_complete_pos = ImGui::GetItemRectMin();
+
+        auto_complete_pos.y = ImGui::GetItemRectMax().y;
+
+        ImVec2 auto_complete_max_size = ImGui::GetItemRectSize();
+        auto_complete_max_size.y = -1.f;
+        ImGui::SetNextWindowPos(auto_complete_pos);
+        ImGui::SetNextWindowSizeConstraints({0.f, 0.f}, auto_complete_max_size);
+        if (ImGui::Begin("##terminal:auto_complete", nullptr, overlay_flags)) {
+            ImGui::SetActiveID(m_input_text_id, ImGui::GetCurrentWindow());
+
+            auto print_separator = [this]() {
+                ImGui::SameLine(0.f, 0.f);
+                int pop = try_push_style(ImGuiCol_Text, ImVec4{0.000f, 0.000f, 0.000f, 0.392f});
+                ImGui::TextUnformatted(m_autocomlete_separator.data(), m_autocomlete_separator.data() + m_autocomlete_separator.size());
+                ImGui::PopStyleColor(pop);
+                ImGui::SameLine(0.f, 0.f);
+            };
+
+            int max_displayable_sv = 0;
+            float separator_length = ImGui::CalcTextSize(m_autocomlete_separator.data(), m_autocomlete_separator.data() + m_autocomlete_separator.size()).x;
+            float total_text_length = ImGui::CalcTextSize("...").x;
+
+            // Glyph widths are cached per key, they only need measuring again when the font size changes
+            luainspector_completion_entry& entry = *m_completion_entry;
+            if (entry.font_size != ImGui::GetFontSize()) {
+                entry.font_size = ImGui::GetFontSize();
+                for (auto& key : entry.keys) key.width = -1.f;
+            }
+            auto autocomplete_text = [&entry, this](std::size_t i) { return entry.name(m_completion_ranked[i]); };
+            const std::size_t autocomplete_count = m_completion_ranked.size();
+
+            for (std::size_t i = 0; i < autocomplete_count; ++i) {
+                luainspector_completion_entry::key& key = entry.keys[m_completion_ranked[i]];
+                if (key.width < 0.f) key.width = ImGui::CalcTextSize(&entry.text[key.off], &entry.text[key.off] + key.len).x;
+                float t_len = key.width + separator_length;
+                if (t_len + total_text_length < auto_complete_max_size.x) {
+                    total_text_length += t_len;
+                    ++max_displayable_sv;
+                } else {
+                    break;
+                }
+            }
+
+            std::string_view last;
+            int pop_count = 0;
+
+            if (max_displayable_sv != 0) {
+                const std::string_view first = autocomplete_text(0);
+                pop_count += try_push_style(ImGuiCol_Text, ImVec4{1.000f, 1.000f, 1.000f, 1.000f});
+                ImGui::TextUnformatted(first.data(), first.data() + first.size());
+                pop_count += try_push_style(ImGuiCol_Text, ImVec4{0.500f, 0.450f, 0.450f, 1.000f});
+                for (int i = 1; i < max_displayable_sv; ++i) {
+                    const std::string_view vs = autocomplete_text(i);
+                    print_separator();
+                    ImGui::TextUnformatted(vs.data(), vs.data() + vs.size());
+                }
+                ImGui::PopStyleColor(pop_count);
+                if (max_displayable_sv < static_cast<long>(autocomplete_count)) last = autocomplete_text(max_displayable_sv);
+            }
+
+            pop_count = 0;
+            if (max_displayable_sv < static_cast<long>(autocomplete_count)) {
+
+                if (max_displayable_sv == 0) {
+                    last = autocomplete_text(0);
+                    pop_count += try_push_style(ImGuiCol_Text, ImVec4{1.000f, 1.000f, 1.000f, 1.000f});
+                    total_text_length -= separator_length;
+                } else {
+                    pop_count += try_push_style(ImGuiCol_Text, ImVec4{0.500f, 0.450f, 0.450f, 1.000f});
+                    print_separator();
+                }
+
+                std::vector<char>& buf = m_ellipsis_buffer;
+                buf.resize(last.size() + 4);
+                std::copy(last.begin(), last.end(), buf.begin());
+                std::fill(buf.begin() + last.size(), buf.end(), '.');
+                auto size = static_cast<unsigned>(last.size() + 3);
+                while (size >= 4 && total_text_length + ImGui::CalcTextSize(buf.data(), buf.data() + size).x >= auto_complete_max_size.x) {
+                    buf[size - 4] = '.';
+                    --size;
+                }
+                while (size != 0 && total_text_length + ImGui::CalcTextSize(buf.data(), buf.data() + size).x >= auto_complete_max_size.x) {
+                    --size;
+                }
+                ImGui::TextUnformatted(buf.data(), buf.data() + size);
+                ImGui::PopStyleColor(pop_count);
+            }
+
+            if (ImGui::IsKeyDown(ImGuiKey_Enter)) {
+                cmd.clear();
+            }
+        }
+        ImGui::End();
+        ImGui::PopStyleVar();
+    }
+}
+
+// Give every log entry not measured yet its wrapped height, as an offset from the entries before it. All entries
+// are measured again only when the wrap width or the font size changed since the last frame.
+void neko::luainspector::measure_log(float wrap_width) {
+    const std::uint64_t first = m_log.evicted();
+    const std::uint64_t end = first + m_log.size();
+    const float font_size = ImGui::GetFontSize();
+
+    if (wrap_width != m_log_wrap_width || font_size != m_log_font_size || m_log_offsets.size() != m_log.capacity()) {
+        m_log_offsets.assign(m_log.capacity(), 0.0);
+        m_log_wrap_width = wrap_width;
+        m_log_font_size = font_size;
+        m_log_measured = first;
+        m_log_end = 0.0;
+    }
+    m_log_measured = std::max(m_log_measured, first);
+
+    const float spacing = ImGui::GetStyle().ItemSpacing.y;
+    for (; m_log_measured < end; ++m_log_measured) {
+        const std::string_view text = m_log.text(m_log[static_cast<std::size_t>(m_log_measured - first)]);
+        m_log_offsets[m_log_measured % m_log_offsets.size()] = m_log_end;
+        m_log_end += ImGui::CalcTextSize(text.data(), text.data() + text.size(), false, wrap_width).y + spacing;
+    }
+}
+
+void neko::luainspector::display(bool* textbox_react) noexcept {
+
+    ImGui::PushStyleColor(ImGuiCol_ChildBg, ImVec4(0.1f, 0.1f, 0.1f, 1.0f));
+
+    ImVec2 size = ImVec2(ImGui::GetContentRegionAvail().x, ImGui::GetWindowSize().y - 125);
+    if (ImGui::BeginChild("##console_log", size)) {
+        const float wrap_width = ImGui::GetContentRegionAvail().x;
+        ImGui::PushTextWrapPos(ImGui::GetCursorPosX() + wrap_width);
+
+        measure_log(wrap_width);
+
+        // Entries have different wrapped heights, so instead of ImGuiListClipper's uniform stepping the first
+        // visible entry is found by binary search over the cached offsets and drawing stops below the window
+        const std::size_t count = m_log.size();
+        const std::size_t capacity = m_log_offsets.size();
+        const std::uint64_t first = m_log.evicted();
+        auto offset_of = [&](std::size_t i) { return m_log_offsets[(first + i) % capacity]; };
+        const double base = count ? offset_of(0) : m_log_end;
+
+        const float start_y = ImGui::GetCursorPosY();
+        const double view_top = ImGui::GetScrollY() - start_y;
+        const double view_bottom = view_top + ImGui::GetWindowHeight();
+
+        std::size_t lo = 0, hi = count;
+        while (lo < hi) {
+            const std::size_t mid = (lo + hi) / 2;
+            if (offset_of(mid) - base <= view_top) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        std::size_t i = lo > 0 ? lo - 1 : 0;
+        if (count) ImGui::SetCursorPosY(start_y + static_cast<float>(offset_of(i) - base));
+
+        for (; i < count && offset_of(i) - base < view_bottom; ++i) {
+            const luainspector_log::entry& e = m_log[i];
+            ImVec4 colour;
+            switch (e.type) {
+                case LUACON_LOG_TYPE_WARNING:
+                    colour = {1.0f, 1.0f, 0.0f, 1.0f};
+                    break;
+                case LUACON_LOG_TYPE_ERROR:
+                    colour = {1.0f, 0.0f, 0.0f, 1.0f};
+                    break;
+                case LUACON_LOG_TYPE_NOTE:
+                    colour = {0.13f, 0.44f, 0.61f, 1.0f};
+                    break;
+                case LUACON_LOG_TYPE_SUCCESS:
+                    colour = {0.0f, 1.0f, 0.0f, 1.0f};
+                    break;
+                case LUACON_LOG_TYPE_MESSAGE:
+                    colour = {1.0f, 1.0f, 1.0f, 1.0f};
+                    break;
+            }
+            const std::string_view text = m_log.text(e);
+            ImGui::PushStyleColor(ImGuiCol_Text, colour);
+            ImGui::TextUnformatted(text.data(), text.data() + text.size());
+            ImGui::PopStyleColor();
+        }
+
+        // Extend the content to the full log height so the scrollbar matches
+        ImGui::SetCursorPosY(start_y + static_cast<float>(m_log_end - base));
+        ImGui::Dummy(ImVec2(0.f, 0.f));
+        ImGui::PopTextWrapPos();
+
+        if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
+            ImGui::SetScrollHereY(1.0f);
+        }
+    }
+    ImGui::EndChild();
+
+    ImGui::PopStyleColor();
+
+    if (m_should_take_focus) {
+        ImGui::SetKeyboardFocusHere();
+        m_should_take_focus = false;
+    }
+
+    ImGui::PushItemWidth(-1.f);
+    if ((this->command_line_input("##Input", &cmd, ImGuiInputTextFlags_CallbackCompletion | ImGuiInputTextFlags_CallbackHistory | ImGuiInputTextFlags_CallbackEdit) || ImGui::IsItemActive()) && textbox_react != nullptr) {
+        *textbox_react = true;
+    }
+    ImGui::PopItemWidth();
+
+    if (m_input_text_id == 0u) {
+        m_input_text_id = ImGui::GetItemID();
+    }
+
+    if (m_command) {
+        static const char spinner[] = "|/-\\";
+        ImGui::TextColored(ImVec4(1.0f, 1.0f, 0.0f, 1.0f), "%c running for %.1f s", spinner[static_cast<int>(ImGui::GetTime() * 8.0) & 3], ImGui::GetTime() - m_command_started);
+        ImGui::SameLine();
+        if (ImGui::SmallButton("Cancel") || (ImGui::IsWindowFocused(ImGuiFocusedFlags_RootAndChildWindows) && ImGui::GetIO().KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_C, false))) cancel_command();
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(ImGui::CalcTextSize("A").x * 12.0f);
+        ImGui::DragInt("Budget##command", &command_budget_us, 10.0f, 100, 100000, "%d us");
+    }
+
+    auto call_command = [&]() {
+        if (m_command) {
+            print_line("A command is still running, cancel it first", LUACON_LOG_TYPE_WARNING);
+            return;
+        }
+        if (!m_history.empty() && m_history.back() != cmd) {
+            m_history.push_back(cmd);
+            m_history.erase(m_history.begin());
+        }
+
+        m_hindex = m_history.size();
+
+        if (L) {
+            start_command();
+        } else {
+            print_line("Lua state pointer is NULL, commands have no effect", LUACON_LOG_TYPE_ERROR);
+        }
+        cmd.clear();
+        m_completion_ranked.clear();
+        m_completion_generation++;  // the command may have changed any table
+    };
+
+    if (m_previously_active_id == m_input_text_id && ImGui::GetActiveID() != m_input_text_id) {
+        if (ImGui::IsKeyDown(ImGuiKey_Enter)) {
+            call_command();
+            m_should_take_focus = true;
+        } else {
+            m_should_take_focus = false;
+        }
+    }
+    m_previously_active_id = ImGui::GetActiveID();
+
+    if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) ImGui::SetScrollHereY(1.0f);
+
+    show_autocomplete();
+}
+
+void neko::luainspector::print_line(std::string_view msg, luainspector_logtype type) noexcept { m_log.push(msg, type); }
+
+static void* __neko_lua_inspector_viewer_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+// Control bytes other than whitespace mean the string is data, not text
+static inline bool is_binary_string(const char* str, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) {
+        const unsigned char c = static_cast<unsigned char>(str[i]);
+        if ((c < 0x20 && c != '\n' && c != '\r' && c != '\t') || c == 0x7f) return true;
+    }
+    return false;
+}
+
+static int __luainspector_string_resize(ImGuiInputTextCallbackData* data) {
+    if (data->EventFlag == ImGuiInputTextFlags_CallbackResize) {
+        std::string* str = static_cast<std::string*>(data->UserData);
+        str->resize(data->BufTextLen);
+        data->Buf = str->data();
+    }
+    return 0;
+}
+
+static void* __neko_lua_inspector_rows_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_pending_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_cursor_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_index_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+static void* __neko_lua_inspector_index_cursor_lightkey() {
+    static char KEY;
+    return &KEY;
+}
+
+// Push the registry table under key, creating it the first time. Walks keep their tables across refreshes and
+// empty them when done instead of dropping them, so refilling them does not reallocate their array part.
+static void __luainspector_push_scratch(lua_State* L, void* key) {
+    lua_pushlightuserdata(L, key);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_type(L, -1) == LUA_TTABLE) return;
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushlightuserdata(L, key);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+// Nil out the slots 1..n of the table at idx, from the top so the border moves down one slot at a time
+static void __luainspector_clear_slots(lua_State* L, int idx, lua_Integer n) {
+    idx = lua_absindex(L, idx);
+    for (lua_Integer i = n; i > 0; --i) {
+        lua_pushnil(L);
+        lua_rawseti(L, idx, i);
+    }
+}
+
+static int __luainspector_walk(lua_State* L) {
+    neko::luainspector* m = static_cast<neko::luainspector*>(lua_touserdata(L, 1));
+    lua_pushboolean(L, m->walk_snapshot_slice(L, static_cast<int>(lua_tointeger(L, 2))));
+    return 1;
+}
+
+// Finalizer of splitmix64, spreads a row's id and fingerprint before they are summed into a table's content
+static std::uint64_t __luainspector_mix(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+// Text of the key at idx. Strings are returned as they are, anything else is formatted into buf: lua_tolstring
+// would turn a number key into a string in place, and lua_next could no longer find it.
+static std::string_view __luainspector_key_text(lua_State* L, int idx, char* buf, std::size_t size) {
+    int n;
+    switch (lua_type(L, idx)) {
+        case LUA_TSTRING: {
+            std::size_t len;
+            const char* str = lua_tolstring(L, idx, &len);
+            return {str, len};
+        }
+        case LUA_TNUMBER:
+            n = lua_isinteger(L, idx) ? std::snprintf(buf, size, "%lld", static_cast<long long>(lua_tointeger(L, idx))) : std::snprintf(buf, size, "%.14g", lua_tonumber(L, idx));
+            break;
+        case LUA_TBOOLEAN:
+            n = std::snprintf(buf, size, "%s", lua_toboolean(L, idx) ? "true" : "false");
+            break;
+        default:
+            n = std::snprintf(buf, size, "[%s %p]", luaL_typename(L, idx), lua_topointer(L, idx));
+            break;
+    }
+    return {buf, std::min(static_cast<std::size_t>(std::max(n, 0)), size - 1)};
+}
+
+// Append the entry at the top of the stack (# -2 key, # -1 value) as a child of m_pending.rows[parent]
+void neko::luainspector::collect_table_row(lua_State* L, int anchor, std::uint32_t parent) {
+    const inspect_table_row& owner = m_pending.rows[parent];
+
+    char buf[64];
+    const std::string_view name = __luainspector_key_text(L, -2, buf, sizeof(buf));
+    int type = lua_type(L, -1);
+
+    inspect_table_row row{};
+    row.name_len = static_cast<std::uint32_t>(name.size());
+    row.id = neko_hash_str(name.data(), name.size(), neko_hash_str(".", 1, owner.type == kRowPage ? owner.fingerprint : owner.id));
+    row.table = owner.type == kRowPage ? owner.table : owner.pointer;
+    row.name_off = static_cast<std::uint32_t>(m_pending.text.size());
+    m_pending.text.insert(m_pending.text.end(), name.begin(), name.end());
+    m_pending.text.push_back('\0');
+    row.table_slot = owner.child_slot;
+    row.depth = parent == 0 ? 0 : owner.depth + 1;
+    row.type = static_cast<std::uint8_t>(type);
+
+    // The key itself, so an edit writes back to the same slot
+    row.key_type = static_cast<std::uint8_t>(lua_type(L, -2));
+    switch (row.key_type) {
+        case LUA_TSTRING:
+            break;
+        case LUA_TNUMBER:
+            row.key_integer = lua_isinteger(L, -2) != 0;
+            if (row.key_integer) {
+                row.key.integer = lua_tointeger(L, -2);
+            } else {
+                row.key.number = lua_tonumber(L, -2);
+            }
+            break;
+        case LUA_TBOOLEAN:
+            row.key.integer = lua_toboolean(L, -2);
+            break;
+        case LUA_TLIGHTUSERDATA:
+            row.key.integer = static_cast<lua_Integer>(reinterpret_cast<std::intptr_t>(lua_touserdata(L, -2)));
+            break;
+        default:  // types after LUA_TSTRING are collectable objects, they can only be pushed again from an anchor
+            if (is_row_open(row.id)) {
+                row.key.slot = static_cast<std::int32_t>(lua_rawlen(L, anchor)) + 1;
+                lua_pushvalue(L, -2);
+                lua_rawseti(L, anchor, row.key.slot);
+            }
+            break;
+    }
+
+    switch (type) {
+        case LUA_TNUMBER:
+            row.number = lua_tonumber(L, -1);
+            row.fingerprint = neko_hash_str(reinterpret_cast<const char*>(&row.number), sizeof(row.number), type);
+            break;
+        case LUA_TBOOLEAN:
+            row.boolean = lua_toboolean(L, -1) != 0;
+            row.fingerprint = row.boolean ? 2 : 1;
+            break;
+        case LUA_TSTRING: {
+            std::size_t len;
+            const char* str = lua_tolstring(L, -1, &len);
+            row.length = len;
+#if LUA_VERSION_NUM >= 504
+            // Strings are immutable, a new value is a new object
+            row.fingerprint = __luainspector_mix(reinterpret_cast<std::uintptr_t>(lua_topointer(L, -1)) ^ len);
+#else
+            if (len <= kHashedString) {
+                row.fingerprint = neko_hash_str(str, len, len);
+            } else {
+                // Length and both ends, a change in the middle of a very long string goes unnoticed
+                const std::size_t ends = 64;
+                row.fingerprint = neko_hash_str(str + len - ends, ends, neko_hash_str(str, ends, len));
+            }
+#endif
+            row.binary_string = is_binary_string(str, std::min<std::size_t>(len, 512));
+            std::size_t preview = 0;
+            if (!row.binary_string) {
+                preview = std::min(len, kStringPreview);
+                if (const void* nl = std::memchr(str, '\n', preview)) preview = static_cast<std::size_t>(static_cast<const char*>(nl) - str);
+                row.preview_off = static_cast<std::uint32_t>(m_pending.text.size());
+                m_pending.text.insert(m_pending.text.end(), str, str + preview);
+            }
+            row.preview_len = static_cast<std::uint32_t>(preview);
+            row.long_string = preview < len;
+            break;
+        }
+        case LUA_TTABLE:
+            row.pointer = lua_topointer(L, -1);
+            // Only tables the user or the search has expanded are walked, they are anchored so the walk can reach them later.
+            // A table is walked once, under the first path that reached it, so cycles like _G._G end there.
+            if (is_row_open(row.id)) {
+                if (row.depth >= m_table_config.max_depth) {
+                    row.too_deep = true;
+                } else if (m_walk_tables.insert(reinterpret_cast<std::uintptr_t>(row.pointer), static_cast<std::uint32_t>(m_pending.rows.size())) != luainspector_ptr_map::kNone) {
+                    row.back_ref = true;
+                } else {
+                    m_walk_tables_added.push_back(reinterpret_cast<std::uintptr_t>(row.pointer));
+                    row.child_slot = static_cast<std::int32_t>(lua_rawlen(L, anchor)) + 1;
+                    lua_pushvalue(L, -1);
+                    lua_rawseti(L, anchor, row.child_slot);
+                }
+            }
+            break;
+        default:
+            row.pointer = lua_topointer(L, -1);
+            break;
+    }
+    if (type != LUA_TNUMBER && type != LUA_TBOOLEAN && type != LUA_TSTRING) row.fingerprint = reinterpret_cast<std::uintptr_t>(row.pointer);
+
+    track_row(row);
+    m_pending.rows.push_back(row);
+}
+
+// Compare a new row with the same path in the displayed snapshot, a key the last walk of its table did not see is new
+void neko::luainspector::track_row(inspect_table_row& row) {
+    const std::uint32_t old = m_row_index.find(row.id);
+    if (old != luainspector_ptr_map::kNone && m_snapshot.rows[old].fingerprint == row.fingerprint) {
+        row.changed = m_snapshot.rows[old].changed;
+        row.content = m_snapshot.rows[old].content;
+        row.stable = m_snapshot.rows[old].stable;
+    } else {
+        row.changed = old != luainspector_ptr_map::kNone || m_walk_parent_known ? m_walk_now : kNeverChanged;
+    }
+    m_walk_content += __luainspector_mix(row.id ^ row.fingerprint);
+}
+
+// Pages are keyed by their first element only, so a growing sequence keeps its last page open
+std::uint64_t neko::luainspector::page_id(std::uint64_t table_id, lua_Integer index) {
+    char buf[32];
+    const int n = std::snprintf(buf, sizeof(buf), "[%lld..", static_cast<long long>((index - 1) / kPageSize * kPageSize + 1));
+    return neko_hash_str(buf, static_cast<std::size_t>(n), neko_hash_str(".", 1, table_id));
+}
+
+// Open the page holding the entry and each of its ancestors, in case the table it is in is paged
+void neko::luainspector::open_pages(const luainspector_search_index& index, std::uint32_t entry, std::unordered_set<std::uint64_t>& open) {
+    for (std::uint32_t e = entry; e != luainspector_search_index::kNoParent; e = index.entries[e].parent) {
+        const luainspector_search_index::entry& en = index.entries[e];
+        char key[24];
+        if (en.key_len == 0 || en.key_len >= sizeof(key)) continue;
+        std::memcpy(key, index.keys.data() + en.key_off, en.key_len);
+        key[en.key_len] = '\0';
+        char* end;
+        const long long k = std::strtoll(key, &end, 10);
+        if (*end != '\0' || k < 1) continue;
+        open.insert(page_id(en.parent == luainspector_search_index::kNoParent ? 0 : index.entries[en.parent].id, k));
+    }
+}
+
+// Replace the sequence 1..n of the table at m_pending.rows[parent] with a summary row and one row per page.
+// They share the anchor slot of the table, the walk fetches the elements of a page only when it is open.
+void neko::luainspector::add_sequence_rows(std::uint32_t parent, lua_Integer n) {
+    const std::uint64_t table_id = m_pending.rows[parent].id;
+    inspect_table_row row{};
+    row.table = m_pending.rows[parent].pointer;
+    row.table_slot = m_pending.rows[parent].child_slot;
+    row.depth = parent == 0 ? 0 : m_pending.rows[parent].depth + 1;
+    row.fingerprint = table_id;
+
+    auto add = [&](const char* name, std::size_t len) {
+        row.id = neko_hash_str(name, len, neko_hash_str(".", 1, table_id));
+        row.name_len = static_cast<std::uint32_t>(len);
+        row.name_off = static_cast<std::uint32_t>(m_pending.text.size());
+        m_pending.text.insert(m_pending.text.end(), name, name + len);
+        m_pending.text.push_back('\0');
+    };
+
+    if (m_table_config.sequence_summary) {
+        add("[summary]", 9);
+        row.type = kRowSummary;
+        row.child_slot = row.table_slot;  // always walked
+        row.summary = static_cast<std::uint32_t>(m_pending.summaries.size());
+        m_pending.summaries.push_back({0.0, 0.0, 0.0, n, 0, false});
+        track_row(row);
+        m_pending.rows.push_back(row);
+    }
+
+    row.type = kRowPage;
+    for (lua_Integer first = 1; first <= n; first += kPageSize) {
+        const lua_Integer last = std::min(n, first + kPageSize - 1);
+        char name[48];
+        const int len = std::snprintf(name, sizeof(name), "[%lld..%lld]", static_cast<long long>(first), static_cast<long long>(last));
+        // Same id as page_id(), the name up to the first ".."
+        const char* dots = std::strstr(name, "..");
+        add(name, static_cast<std::size_t>(len));
+        row.id = neko_hash_str(name, static_cast<std::size_t>(dots + 2 - name), neko_hash_str(".", 1, table_id));
+        row.page.first = first;
+        row.page.last = last;
+        row.child_slot = is_row_open(row.id) ? row.table_slot : 0;
+        track_row(row);
+        m_pending.rows.push_back(row);
+    }
+    m_walk_content += __luainspector_mix(static_cast<std::uint64_t>(n));
+}
+
+// Collect the elements of the page at m_walk_row from the table at the top of the stack, false when out of time
+bool neko::luainspector::walk_page(lua_State* L, int anchor, int budget_us, std::chrono::steady_clock::time_point deadline, unsigned& visited) {
+    const lua_Integer last = m_pending.rows[m_walk_row].page.last;
+    while (m_walk_index <= last) {
+        const lua_Integer i = m_walk_index++;
+        lua_pushinteger(L, i);
+        if (lua_rawgeti(L, -2, i) != LUA_TNIL) collect_table_row(L, anchor, m_walk_row);  // nil if it shrank since
+        lua_pop(L, 2);
+        if (budget_us > 0 && (++visited & 63) == 0 && std::chrono::steady_clock::now() >= deadline) return false;
+    }
+    return true;
+}
+
+// Min, max, sum and NaN count of a block, two lanes at a time with SSE2 where the target has it. MINPD/MAXPD
+// return their second operand when the first is NaN, so NaN elements never reach the bounds.
+static void __luainspector_summarize(const double* v, std::size_t n, neko::inspect_sequence_summary& s) {
+    double lo = s.min, hi = s.max, sum = 0.0;
+    std::uint32_t nan = 0;
+    std::size_t i = 0;
+#if NEKO_LUAINSPECTOR_SSE2
+    __m128d vlo = _mm_set1_pd(lo), vhi = _mm_set1_pd(hi), vsum0 = _mm_setzero_pd(), vsum1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        const __m128d a = _mm_loadu_pd(v + i), b = _mm_loadu_pd(v + i + 2);
+        vlo = _mm_min_pd(b, _mm_min_pd(a, vlo));
+        vhi = _mm_max_pd(b, _mm_max_pd(a, vhi));
+        const __m128d oa = _mm_cmpord_pd(a, a), ob = _mm_cmpord_pd(b, b);
+        vsum0 = _mm_add_pd(vsum0, _mm_and_pd(oa, a));
+        vsum1 = _mm_add_pd(vsum1, _mm_and_pd(ob, b));
+        const int ordered = _mm_movemask_pd(oa) | (_mm_movemask_pd(ob) << 2);
+        nan += 4 - ((ordered & 1) + (ordered >> 1 & 1) + (ordered >> 2 & 1) + (ordered >> 3 & 1));
+    }
+    double l[2], h[2], t[2];
+    _mm_storeu_pd(l, vlo);
+    _mm_storeu_pd(h, vhi);
+    _mm_storeu_pd(t, _mm_add_pd(vsum0, vsum1));
+    lo = std::min(l[0], l[1]);
+    hi = std::max(h[0], h[1]);
+    sum = t[0] + t[1];
+#endif
+    for (; i < n; ++i) {
+        const double x = v[i];
+        if (x != x) {
+            ++nan;
+            continue;
+        }
+        lo = std::min(lo, x);
+        hi = std::max(hi, x);
+        sum += x;
+    }
+    s.min = lo;
+    s.max = hi;
+    s.sum += sum;
+    s.nan += nan;
+}
+
+// Summarize the sequence of the table at the top of the stack for the summary row at m_walk_row, a chunk of
+// elements at a time copied out to a buffer. Stops at the first element that is not a number.
+bool neko::luainspector::walk_summary(lua_State* L, int budget_us, std::chrono::steady_clock::time_point deadline, unsigned& visited) {
+    inspect_sequence_summary& s = m_pending.summaries[m_pending.rows[m_walk_row].summary];
+    if (m_walk_index == 1) {
+        s.min = HUGE_VAL;
+        s.max = -HUGE_VAL;
+        s.sum = 0.0;
+        s.nan = 0;
+        s.numeric = true;
+    }
+    const lua_Integer n = s.count;
+    while (m_walk_index <= n && s.numeric) {
+        const lua_Integer end = std::min(n, m_walk_index + kSummaryChunk - 1);
+        m_summary_buffer.clear();
+        lua_Integer i = m_walk_index;
+        for (; i <= end; ++i) {
+            const bool number = lua_rawgeti(L, -1, i) == LUA_TNUMBER;
+            if (number) m_summary_buffer.push_back(lua_tonumber(L, -1));
+            lua_pop(L, 1);
+            if (!number) {
+                s.numeric = false;
+                break;
+            }
+        }
+        if (s.numeric) __luainspector_summarize(m_summary_buffer.data(), m_summary_buffer.size(), s);
+        visited += static_cast<unsigned>(std::min(i, end) - m_walk_index + 1);
+        m_walk_index = end + 1;
+        if (budget_us > 0 && std::chrono::steady_clock::now() >= deadline) return false;
+    }
+
+    // Its content is the result, so a summary that moved is shown as changed
+    m_walk_content = neko_hash_str(reinterpret_cast<const char*>(&s.sum), sizeof(s.sum), neko_hash_str(reinterpret_cast<const char*>(&s.min), sizeof(s.min) * 2, s.nan)) | 1;
+    return true;
+}
+
+// Copy the children of the table at m_pending.rows[parent] from the displayed snapshot instead of walking it,
+// when its last walks found it unchanged. Lua keeps no version of a table's content so a stable table is still
+// walked now and then, every other refresh after one unchanged walk and every fourth after two. Tables open
+// below it keep their anchor slot contents, moved from the old anchor at old_anchor to the new one at anchor.
+bool neko::luainspector::reuse_table_rows(lua_State* L, int anchor, int old_anchor, std::uint32_t parent) {
+    if (m_walk_full || old_anchor == 0 || parent == 0) return false;
+    const inspect_table_row& t = m_pending.rows[parent];
+    const std::uint32_t o = m_row_index.find(t.id);
+    if (o == luainspector_ptr_map::kNone) return false;
+
+    const inspect_table_row& old = m_snapshot.rows[o];
+    const bool sequence = t.type == kRowPage || t.type == kRowSummary;
+    if (old.child_slot == 0 || old.type != t.type || (sequence ? old.table != t.table : old.pointer != t.pointer) || old.stable == 0) return false;
+    const std::uint64_t period = (1u << std::min<std::uint32_t>(old.stable, 2)) - 1;
+    if (((m_snapshot.generation + t.id) & period) == 0) return false;
+
+    // Open state may have changed since, and a child table may have been reached first under another path this
+    // time. The walk decides which child tables get anchored then.
+    for (std::uint32_t i = old.child_begin; i < old.child_begin + old.child_count; ++i) {
+        const inspect_table_row& c = m_snapshot.rows[i];
+        if ((c.type == LUA_TTABLE || c.type == kRowPage) && (c.child_slot != 0 || c.back_ref || c.too_deep) != is_row_open(c.id)) return false;
+        if (c.key_type > LUA_TSTRING && (c.key.slot != 0) != is_row_open(c.id)) return false;
+        if (c.type == LUA_TTABLE && c.child_slot != 0 && m_walk_tables.find(reinterpret_cast<std::uintptr_t>(c.pointer)) != luainspector_ptr_map::kNone) return false;
+    }
+
+    if (t.type == kRowSummary) m_pending.summaries[t.summary] = m_snapshot.summaries[old.summary];
+    const std::int32_t slot = t.child_slot;
+    m_pending.rows[parent].child_begin = static_cast<std::uint32_t>(m_pending.rows.size());
+    m_pending.rows[parent].child_count = old.child_count;
+    for (std::uint32_t i = old.child_begin; i < old.child_begin + old.child_count; ++i) {
+        inspect_table_row row = m_snapshot.rows[i];
+        const char* name = m_snapshot.name(row);
+        row.name_off = static_cast<std::uint32_t>(m_pending.text.size());
+        m_pending.text.insert(m_pending.text.end(), name, name + row.name_len + 1);
+        if (row.preview_len != 0) {
+            const char* preview = m_snapshot.text.data() + row.preview_off;
+            row.preview_off = static_cast<std::uint32_t>(m_pending.text.size());
+            m_pending.text.insert(m_pending.text.end(), preview, preview + row.preview_len);
+        }
+        row.table_slot = slot;
+        if (row.key_type > LUA_TSTRING && row.key.slot != 0) {
+            lua_rawgeti(L, old_anchor, row.key.slot);
+            row.key.slot = static_cast<std::int32_t>(lua_rawlen(L, anchor)) + 1;
+            lua_rawseti(L, anchor, row.key.slot);
+        }
+        if (row.type == kRowSummary) {
+            m_pending.summaries.push_back(m_snapshot.summaries[row.summary]);
+            row.summary = static_cast<std::uint32_t>(m_pending.summaries.size() - 1);
+        }
+        if (row.type == kRowPage || row.type == kRowSummary) {
+            if (row.child_slot != 0) row.child_slot = slot;
+        } else if (row.child_slot != 0) {
+            m_walk_tables.insert(reinterpret_cast<std::uintptr_t>(row.pointer), static_cast<std::uint32_t>(m_pending.rows.size()));
+            m_walk_tables_added.push_back(reinterpret_cast<std::uintptr_t>(row.pointer));
+            lua_rawgeti(L, old_anchor, row.child_slot);
+            row.child_slot = static_cast<std::int32_t>(lua_rawlen(L, anchor)) + 1;
+            lua_rawseti(L, anchor, row.child_slot);
+            row.child_begin = 0;
+            row.child_count = 0;
+        }
+        m_pending.rows.push_back(row);
+    }
+    return true;
+}
+
+// Compare the content of the table just walked at m_pending.rows[r] with the last walk
+void neko::luainspector::end_table_walk(std::uint32_t r) {
+    inspect_table_row& t = m_pending.rows[r];
+    if (t.content == m_walk_content) {
+        if (t.stable < 0xff) ++t.stable;
+        return;
+    }
+    if (t.content != 0) t.changed = m_walk_now;
+    t.content = m_walk_content;
+    t.stable = 0;
+}
+
+// Start a new walk of the table at the top of the stack into m_pending
+void neko::luainspector::begin_snapshot(lua_State* L) {
+    m_pending.rows.clear();
+    m_pending.text.clear();
+    m_pending.text.push_back('\0');
+    m_pending.summaries.clear();
+
+    // Anchor table keeps every walked table reachable by slot, so rows can be resolved after the walk
+    __luainspector_push_scratch(L, __neko_lua_inspector_pending_lightkey());
+    __luainspector_clear_slots(L, -1, static_cast<lua_Integer>(lua_rawlen(L, -1)));
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, 1);
+    lua_pop(L, 1);
+
+    // Cursor pins the table being walked and the last key handed to lua_next across frames
+    __luainspector_push_scratch(L, __neko_lua_inspector_cursor_lightkey());
+    lua_pop(L, 1);
+
+    inspect_table_row root{};
+    root.child_slot = 1;
+    root.type = LUA_TTABLE;
+    root.pointer = lua_topointer(L, -1);
+    root.fingerprint = reinterpret_cast<std::uintptr_t>(root.pointer);
+    root.changed = kNeverChanged;
+    if (!m_snapshot.rows.empty() && m_snapshot.rows[0].pointer == root.pointer) {
+        root.content = m_snapshot.rows[0].content;
+        root.changed = m_snapshot.rows[0].changed;
+    }
+    m_pending.rows.push_back(root);
+
+    // Rows of the displayed snapshot by path, to tell what changed. The root is id 0, the empty key of the map.
+    m_row_index.clear();
+    for (std::uint32_t i = 1; i < m_snapshot.rows.size(); ++i) m_row_index.insert(m_snapshot.rows[i].id, i);
+    m_walk_tables.clear();
+    m_walk_tables.insert(reinterpret_cast<std::uintptr_t>(root.pointer), 0);
+    m_walk_now = ImGui::GetTime();
+    m_walk_full = m_snapshot.dirty;  // an explicit refresh or a newly expanded table looks at everything
+    m_snapshot.dirty = false;        // raised again while the walk runs, it carries over to the walked snapshot
+
+    m_walk_row = 0;
+    m_walk_marked_row = UINT32_MAX;
+    m_walk_started = false;
+    m_walk_retries = 0;
+    m_walking = true;
+}
+
+// Walk until done or until budget_us microseconds have passed (0 means no budget). Tables are walked in the
+// order they were reached and each one appends its children as a contiguous run, so a walk spread over
+// several frames still produces the same layout. Runs under lua_pcall, see walk_snapshot().
+bool neko::luainspector::walk_snapshot_slice(lua_State* L, int budget_us) {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point deadline = clock::now() + std::chrono::microseconds(budget_us);
+
+    lua_pushlightuserdata(L, __neko_lua_inspector_pending_lightkey());
+    lua_gettable(L, LUA_REGISTRYINDEX);
+    const int anchor = lua_gettop(L);
+    lua_pushlightuserdata(L, __neko_lua_inspector_rows_lightkey());
+    lua_gettable(L, LUA_REGISTRYINDEX);
+    const int old_anchor = lua_type(L, -1) == LUA_TTABLE ? lua_gettop(L) : 0;
+    lua_pushlightuserdata(L, __neko_lua_inspector_cursor_lightkey());
+    lua_gettable(L, LUA_REGISTRYINDEX);
+    const int cursor = lua_gettop(L);
+
+    unsigned visited = 0;
+    for (; m_walk_row < m_pending.rows.size(); ++m_walk_row) {
+        if (m_pending.rows[m_walk_row].child_slot == 0) continue;
+
+        if (!m_walk_started) {
+            // What the row adds from here on, copied or walked, is taken back if the slice raises
+            m_walk_marked_row = m_walk_row;
+            m_walk_rows_begin = static_cast<std::uint32_t>(m_pending.rows.size());
+            m_walk_text_begin = static_cast<std::uint32_t>(m_pending.text.size());
+            m_walk_summaries_begin = static_cast<std::uint32_t>(m_pending.summaries.size());
+            m_walk_anchor_begin = static_cast<lua_Integer>(lua_rawlen(L, anchor));
+            m_walk_tables_added.clear();
+        }
+        if (!m_walk_started && reuse_table_rows(L, anchor, old_anchor, m_walk_row)) {
+            const unsigned before = visited;
+            visited += m_pending.rows[m_walk_row].child_count;
+            if (budget_us > 0 && (before >> 6) != (visited >> 6) && clock::now() >= deadline) {
+                ++m_walk_row;
+                lua_settop(L, cursor);
+                return false;
+            }
+            continue;
+        }
+
+        const std::uint8_t kind = m_pending.rows[m_walk_row].type;
+        if (!m_walk_started) {
+            lua_rawgeti(L, anchor, m_pending.rows[m_walk_row].child_slot);
+            lua_rawseti(L, cursor, 1);
+            lua_pushnil(L);
+            lua_rawseti(L, cursor, 2);
+            m_pending.rows[m_walk_row].child_begin = static_cast<std::uint32_t>(m_pending.rows.size());
+            m_walk_content = 1;  // a walked table never has content 0
+            m_walk_parent_known = m_pending.rows[m_walk_row].content != 0;
+            m_walk_border = 0;
+            m_walk_index = kind == kRowPage ? m_pending.rows[m_walk_row].page.first : 1;
+            m_walk_started = true;
+
+            if (kind == LUA_TTABLE) {
+                lua_rawgeti(L, cursor, 1);
+                const lua_Integer n = static_cast<lua_Integer>(lua_rawlen(L, -1));
+                lua_pop(L, 1);
+                if (n > kPageSize) {
+                    // The walk still goes through every key from the first, resuming after #t would miss the keys
+                    // lua_next hands out before it when #t sits in the hash part
+                    add_sequence_rows(m_walk_row, n);
+                    m_walk_border = n;
+                }
+            }
+        }
+
+        lua_rawgeti(L, cursor, 1);  // table
+        if (kind == kRowPage || kind == kRowSummary) {
+            const bool done = kind == kRowPage ? walk_page(L, anchor, budget_us, deadline, visited) : walk_summary(L, budget_us, deadline, visited);
+            m_pending.rows[m_walk_row].child_count = static_cast<std::uint32_t>(m_pending.rows.size()) - m_pending.rows[m_walk_row].child_begin;
+            if (!done) {
+                lua_settop(L, cursor);
+                return false;
+            }
+            lua_pop(L, 1);  // table
+            end_table_walk(m_walk_row);
+            m_walk_started = false;
+            m_walk_retries = 0;
+            continue;
+        }
+        lua_rawgeti(L, cursor, 2);  // last key
+        while (lua_next(L, -2) != 0) {
+            if (m_walk_border == 0 || !lua_isinteger(L, -2) || lua_tointeger(L, -2) < 1 || lua_tointeger(L, -2) > m_walk_border) {
+                collect_table_row(L, anchor, m_walk_row);
+            }
+            lua_pop(L, 1);  // value, or an element in a page
+
+            if (budget_us > 0 && (++visited & 63) == 0 && clock::now() >= deadline) {
+                lua_rawseti(L, cursor, 2);  // resume after this key next frame
+                m_pending.rows[m_walk_row].child_count = static_cast<std::uint32_t>(m_pending.rows.size()) - m_pending.rows[m_walk_row].child_begin;
+                lua_settop(L, cursor);
+                return false;
+            }
+        }
+        lua_pop(L, 1);  // table
+
+        m_pending.rows[m_walk_row].child_count = static_cast<std::uint32_t>(m_pending.rows.size()) - m_pending.rows[m_walk_row].child_begin;
+        end_table_walk(m_walk_row);
+        m_walk_started = false;
+        m_walk_retries = 0;
+    }
+
+    lua_settop(L, cursor);
+    return true;
+}
+
+// Advance the pending walk by one slice, swaps it in as the displayed snapshot when it completes
+bool neko::luainspector::walk_snapshot(lua_State* L, int budget_us) {
+    if (!lua_checkstack(L, 3)) return false;  // the slice itself runs with the LUA_MINSTACK slots of a C function
+    lua_pushcfunction(L, &__luainspector_walk);
+    lua_pushlightuserdata(L, this);
+    lua_pushinteger(L, budget_us);
+
+    if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+        // The table changed under the cursor (e.g. a rehash dropped the last key), restart it once then give up on it.
+        // Everything the row added goes: rows (pages included), text, summaries, the tables it claimed as visited
+        // and the anchor slots of its child tables and keys. An error before the row got that far only skips it.
+        lua_pop(L, 1);
+        m_walk_started = false;
+        if (m_walk_row >= m_pending.rows.size()) return false;
+        if (m_walk_marked_row != m_walk_row) {
+            m_walk_retries = 0;
+            ++m_walk_row;
+            return false;
+        }
+        m_pending.rows.resize(m_walk_rows_begin);
+        m_pending.text.resize(m_walk_text_begin);
+        m_pending.summaries.resize(m_walk_summaries_begin);
+        for (std::uintptr_t table : m_walk_tables_added) m_walk_tables.erase(table);
+        m_walk_tables_added.clear();
+        lua_pushlightuserdata(L, __neko_lua_inspector_pending_lightkey());
+        lua_rawget(L, LUA_REGISTRYINDEX);
+        for (lua_Integer i = static_cast<lua_Integer>(lua_rawlen(L, -1)); i > m_walk_anchor_begin; --i) {
+            lua_pushnil(L);
+            lua_rawseti(L, -2, i);
+        }
+        lua_pop(L, 1);
+        m_pending.rows[m_walk_row].child_count = 0;
+        m_walk_marked_row = UINT32_MAX;
+        if (++m_walk_retries > 1) {
+            m_walk_retries = 0;
+            ++m_walk_row;
+        }
+        return false;
+    }
+
+    const bool done = lua_toboolean(L, -1) != 0;
+    lua_pop(L, 1);
+    if (!done) return false;
+
+    std::swap(m_snapshot, m_pending);
+    m_walking = false;
+
+    // The walked anchor becomes the rows anchor, the old one is emptied and kept for the next walk
+    lua_pushlightuserdata(L, __neko_lua_inspector_rows_lightkey());
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_type(L, -1) == LUA_TTABLE) __luainspector_clear_slots(L, -1, static_cast<lua_Integer>(lua_rawlen(L, -1)));
+    lua_pushlightuserdata(L, __neko_lua_inspector_rows_lightkey());
+    lua_pushlightuserdata(L, __neko_lua_inspector_pending_lightkey());
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    lua_pushlightuserdata(L, __neko_lua_inspector_pending_lightkey());
+    lua_insert(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    __luainspector_push_scratch(L, __neko_lua_inspector_cursor_lightkey());
+    __luainspector_clear_slots(L, -1, 2);
+    lua_pop(L, 1);
+
+    m_snapshot.time = ImGui::GetTime();
+    m_snapshot.generation = m_pending.generation + 1;
+    m_snapshot.dirty = m_pending.dirty;  // e.g. a row expanded during the walk
+    m_visible_dirty = true;
+    return true;
+}
 
-        auto_complete_pos.y = ImGui::GetItemRectMax().y;
+// Re-walk the expanded part of the table at the top of the stack in one go
+void neko::luainspector::refresh_snapshot(lua_State* L) {
+    if (!m_walking) begin_snapshot(L);
+    while (!walk_snapshot(L, 0)) {
+    }
+}
 
-        ImVec2 auto_complete_max_size = ImGui::GetItemRectSize();
-        auto_complete_max_size.y = -1.f;
-        ImGui::SetNextWindowPos(auto_complete_pos);
-        ImGui::SetNextWindowSizeConstraints({0.f, 0.f}, auto_complete_max_size);
-        if (ImGui::Begin("##terminal:auto_complete", nullptr, overlay_flags)) {
-            ImGui::SetActiveID(m_input_text_id, ImGui::GetCurrentWindow());
+static int __luainspector_index_walk(lua_State* L) {
+    neko::luainspector* m = static_cast<neko::luainspector*>(lua_touserdata(L, 1));
+    lua_pushboolean(L, m->walk_search_index_slice(L, static_cast<int>(lua_tointeger(L, 2))));
+    return 1;
+}
 
-            auto print_separator = [this]() {
-                ImGui::SameLine(0.f, 0.f);
-                int pop = try_push_style(ImGuiCol_Text, ImVec4{0.000f, 0.000f, 0.000f, 0.392f});
-                ImGui::TextUnformatted(m_autocomlete_separator.data(), m_autocomlete_separator.data() + m_autocomlete_separator.size());
-                ImGui::PopStyleColor(pop);
-                ImGui::SameLine(0.f, 0.f);
-            };
+// Start indexing everything reachable from the table at the top of the stack
+void neko::luainspector::begin_search_index(lua_State* L) {
+    // The previous index is refilled unless a search query still holds it
+    if (m_index_spare && m_index_spare.use_count() == 1) {
+        m_index_pending = std::move(m_index_spare);
+        m_index_pending->clear();
+    } else {
+        m_index_pending = std::make_shared<luainspector_search_index>();
+    }
+    m_index_queue.clear();
+    m_index_visited.clear();
+    m_index_head = 0;
+    m_index_started = false;
+
+    // Queue of tables still to be walked, slot n + 1 holds the table of m_index_queue[n]. Slots are
+    // niled as the walk goes, the border is no help to clear it so it is emptied when the walk completes.
+    __luainspector_push_scratch(L, __neko_lua_inspector_index_lightkey());
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, 1);
+    lua_pop(L, 1);
 
-            int max_displayable_sv = 0;
-            float separator_length = ImGui::CalcTextSize(m_autocomlete_separator.data(), m_autocomlete_separator.data() + m_autocomlete_separator.size()).x;
-            float total_text_length = ImGui::CalcTextSize("...").x;
+    __luainspector_push_scratch(L, __neko_lua_inspector_index_cursor_lightkey());
+    lua_pop(L, 1);
 
-            std::vector<std::string_view> autocomplete_text;
+    m_index_queue.push_back(luainspector_search_index::kNoParent);
+    m_index_visited.insert(reinterpret_cast<std::uintptr_t>(lua_topointer(L, -1)), 0);
+}
+
+// Same resumable scheme as walk_snapshot_slice(), over every table instead of the expanded ones. Each
+// table is queued once, so cycles and shared tables are indexed under the first path that reached them.
+bool neko::luainspector::walk_search_index_slice(lua_State* L, int budget_us) {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point deadline = clock::now() + std::chrono::microseconds(budget_us);
+
+    lua_pushlightuserdata(L, __neko_lua_inspector_index_lightkey());
+    lua_gettable(L, LUA_REGISTRYINDEX);
+    const int queue = lua_gettop(L);
+    lua_pushlightuserdata(L, __neko_lua_inspector_index_cursor_lightkey());
+    lua_gettable(L, LUA_REGISTRYINDEX);
+    const int cursor = lua_gettop(L);
+
+    luainspector_search_index& index = *m_index_pending;
+    unsigned visited = 0;
+    for (; m_index_head < m_index_queue.size(); ++m_index_head) {
+        const int slot = static_cast<int>(m_index_head) + 1;
+        if (!m_index_started) {
+            lua_rawgeti(L, queue, slot);
+            index.tables.push_back({m_index_queue[m_index_head], static_cast<std::uint32_t>(std::min<std::size_t>(lua_rawlen(L, -1), 0xffffffffu)), 0, 0, 0});
+            lua_rawseti(L, cursor, 1);
+            lua_pushnil(L);
+            lua_rawseti(L, cursor, 2);
+            lua_pushnil(L);
+            lua_rawseti(L, queue, slot);  // the cursor pins it from now on
+            m_index_started = true;
+        }
 
-            if (m_current_autocomplete_strings.empty()) {
+        const std::uint32_t parent = m_index_queue[m_index_head];
+        const std::uint64_t parent_id = parent == luainspector_search_index::kNoParent ? 0 : index.entries[parent].id;
+
+        luainspector_search_index::table_stats& stats = index.tables.back();
+        lua_rawgeti(L, cursor, 1);  // table
+        lua_rawgeti(L, cursor, 2);  // last key
+        while (lua_next(L, -2) != 0) {
+            if (lua_isinteger(L, -2) && lua_tointeger(L, -2) >= 1 && static_cast<lua_Unsigned>(lua_tointeger(L, -2)) <= stats.border) {
+                ++stats.array;
             } else {
-                autocomplete_text.reserve(m_current_autocomplete_strings.size());
-                for (const std::string& str : m_current_autocomplete_strings) {
-                    autocomplete_text.emplace_back(str);
-                }
+                ++stats.hash;
             }
 
-            for (const std::string_view& sv : autocomplete_text) {
-                float t_len = ImGui::CalcTextSize(sv.data(), sv.data() + sv.size()).x + separator_length;
-                if (t_len + total_text_length < auto_complete_max_size.x) {
-                    total_text_length += t_len;
-                    ++max_displayable_sv;
-                } else {
-                    break;
+            // Same text and so the same ids as the Registry rows, only string and number keys can be searched for
+            char buf[64];
+            const int key_type = lua_type(L, -2);
+            const std::string_view key_text = key_type == LUA_TSTRING || key_type == LUA_TNUMBER ? __luainspector_key_text(L, -2, buf, sizeof(buf)) : std::string_view();
+            const char* key = key_text.data();
+            const std::size_t len = key_text.size();
+
+            if (key) {
+                const std::uint32_t entry = static_cast<std::uint32_t>(index.entries.size());
+                const int type = lua_type(L, -1);
+                index.add_entry(neko_hash_str(key, len, neko_hash_str(".", 1, parent_id)), parent, key, len, type);
+                if (type == LUA_TTABLE && m_index_visited.insert(reinterpret_cast<std::uintptr_t>(lua_topointer(L, -1)), entry) == luainspector_ptr_map::kNone) {
+                    m_index_queue.push_back(entry);
+                    lua_pushvalue(L, -1);
+                    lua_rawseti(L, queue, static_cast<lua_Integer>(m_index_queue.size()));
                 }
             }
+            lua_pop(L, 1);  // value
 
-            std::string_view last;
-            int pop_count = 0;
+            if (budget_us > 0 && (++visited & 63) == 0 && clock::now() >= deadline) {
+                lua_rawseti(L, cursor, 2);  // resume after this key next frame
+                lua_settop(L, cursor);
+                return false;
+            }
+        }
+        lua_pop(L, 1);  // table
+        m_index_started = false;
+    }
 
-            if (max_displayable_sv != 0) {
-                const std::string_view& first = autocomplete_text[0];
-                pop_count += try_push_style(ImGuiCol_Text, ImVec4{1.000f, 1.000f, 1.000f, 1.000f});
-                ImGui::TextUnformatted(first.data(), first.data() + first.size());
-                pop_count += try_push_style(ImGuiCol_Text, ImVec4{0.500f, 0.450f, 0.450f, 1.000f});
-                for (int i = 1; i < max_displayable_sv; ++i) {
-                    const std::string_view vs = autocomplete_text[i];
-                    print_separator();
-                    ImGui::TextUnformatted(vs.data(), vs.data() + vs.size());
-                }
-                ImGui::PopStyleColor(pop_count);
-                if (max_displayable_sv < static_cast<long>(autocomplete_text.size())) last = autocomplete_text[max_displayable_sv];
+    lua_settop(L, cursor);
+    return true;
+}
+
+// Advance the index walk by one slice, publishes the index for queries when it completes
+bool neko::luainspector::walk_search_index(lua_State* L, int budget_us) {
+    if (!lua_checkstack(L, 3)) return false;
+    lua_pushcfunction(L, &__luainspector_index_walk);
+    lua_pushlightuserdata(L, this);
+    lua_pushinteger(L, budget_us);
+
+    if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+        // The table changed under the cursor, keep what was indexed of it and move on
+        lua_pop(L, 1);
+        m_index_started = false;
+        ++m_index_head;
+        return false;
+    }
+
+    const bool done = lua_toboolean(L, -1) != 0;
+    lua_pop(L, 1);
+    if (!done) return false;
+
+    // Array slots are 16 byte values, the hash part is a power of two of 32 byte nodes, plus the Table header
+    for (luainspector_search_index::table_stats& t : m_index_pending->tables) {
+        std::uint64_t nodes = t.hash ? 1 : 0;
+        while (nodes < t.hash) nodes <<= 1;
+        t.bytes = 56 + 16 * static_cast<std::uint64_t>(t.array) + 32 * nodes;
+    }
+
+    m_index_spare = std::const_pointer_cast<luainspector_search_index>(std::move(m_search_index));
+    m_search_index = std::move(m_index_pending);
+    m_index_pending.reset();
+    m_table_order_index = nullptr;  // the spare may come back at the same address
+    m_index_time = ImGui::GetTime();
+
+    // Every queued slot was niled when its table was reached, only the queue's own entries remain
+    __luainspector_push_scratch(L, __neko_lua_inspector_index_lightkey());
+    __luainspector_clear_slots(L, -1, static_cast<lua_Integer>(m_index_queue.size()));
+    __luainspector_push_scratch(L, __neko_lua_inspector_index_cursor_lightkey());
+    __luainspector_clear_slots(L, -1, 2);
+    lua_pop(L, 2);
+    m_index_queue.clear();
+    m_index_visited.clear();
+    return true;
+}
+
+// Start a new walk of the table at the top of the stack once the index is stale and advance it by a slice.
+// Returns true when a fresh index has just been published.
+bool neko::luainspector::update_index(lua_State* L, const inspect_table_config& cfg) {
+    if (!m_index_pending && (!m_search_index || ImGui::GetTime() - m_index_time >= cfg.search_index_interval)) begin_search_index(L);
+    return m_index_pending && walk_search_index(L, cfg.walk_budget_us);
+}
+
+// Keep the index fresh while the search box is in use, run queries on a worker and expand the ancestors of the matches
+void neko::luainspector::update_search(lua_State* L, const inspect_table_config& cfg) {
+    const bool searching = cfg.search_str != 0 && cfg.search_str[0] != '\0';
+    if (!searching) {
+        if (!m_search_matches.empty() || !m_search_expanded.empty()) {
+            m_search_matches.clear();
+            m_search_expanded.clear();
+            m_visible_dirty = true;
+        }
+        m_search_result.index.reset();
+        return;
+    }
+
+    if (update_index(L, cfg)) m_search_dirty = true;
+
+    if (m_search_future.valid() && m_search_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        m_search_result = m_search_future.get();
+        const luainspector_search_index& index = *m_search_result.index;
+
+        m_search_matches.clear();
+        m_search_expanded.clear();
+        for (std::uint32_t match : m_search_result.matches) {
+            m_search_matches.insert(index.entries[match].id);
+            for (std::uint32_t p = index.entries[match].parent; p != luainspector_search_index::kNoParent; p = index.entries[p].parent) {
+                if (!m_search_expanded.insert(index.entries[p].id).second) break;
             }
+            open_pages(index, match, m_search_expanded);
+        }
+        m_snapshot.dirty = true;  // walk into the newly expanded ancestors
+        m_visible_dirty = true;
+    }
 
-            pop_count = 0;
-            if (max_displayable_sv < static_cast<long>(autocomplete_text.size())) {
+    if (m_search_dirty && m_search_index && !m_search_future.valid()) {
+        m_search_dirty = false;
+        m_search_future = std::async(std::launch::async, [index = m_search_index, query = std::string(cfg.search_str), max_results = static_cast<std::size_t>(cfg.search_max_results)]() {
+            luainspector_search_result result;
+            result.index = index;
+            index->query(query, max_results, result.matches, result.total);
+            return result;
+        });
+    }
+}
 
-                if (max_displayable_sv == 0) {
-                    last = autocomplete_text.front();
-                    pop_count += try_push_style(ImGuiCol_Text, ImVec4{1.000f, 1.000f, 1.000f, 1.000f});
-                    total_text_length -= separator_length;
-                } else {
-                    pop_count += try_push_style(ImGuiCol_Text, ImVec4{0.500f, 0.450f, 0.450f, 1.000f});
-                    print_separator();
-                }
+// NaN first, so sorting a column with NaN in it stays a strict weak order
+static int __luainspector_cmp_number(double a, double b) {
+    const bool na = a != a, nb = b != b;
+    if (na || nb) return static_cast<int>(nb) - static_cast<int>(na);
+    return a < b ? -1 : a > b ? 1 : 0;
+}
 
-                std::vector<char> buf;
-                buf.resize(last.size() + 4);
-                std::copy(last.begin(), last.end(), buf.begin());
-                std::fill(buf.begin() + last.size(), buf.end(), '.');
-                auto size = static_cast<unsigned>(last.size() + 3);
-                while (size >= 4 && total_text_length + ImGui::CalcTextSize(buf.data(), buf.data() + size).x >= auto_complete_max_size.x) {
-                    buf[size - 4] = '.';
-                    --size;
-                }
-                while (size != 0 && total_text_length + ImGui::CalcTextSize(buf.data(), buf.data() + size).x >= auto_complete_max_size.x) {
-                    --size;
+// Children of the walked table at m_snapshot.rows[parent] as offsets from its child_begin, in the order of the
+// Registry sort. Summary and page rows stay first and in sequence order.
+const std::vector<std::uint32_t>& neko::luainspector::sorted_children(std::uint32_t parent) {
+    const auto& rows = m_snapshot.rows;
+    const inspect_table_row& t = rows[parent];
+    const int column = m_sort_column;
+    const bool ascending = m_sort_ascending;
+
+    std::uint64_t members = __luainspector_mix(static_cast<std::uint64_t>(column * 2 + ascending) + 1);
+    std::uint64_t layout = 14695981039346656037ull;
+    for (std::uint32_t i = t.child_begin; i < t.child_begin + t.child_count; ++i) {
+        std::uint64_t member = rows[i].id;
+        if (column == 1) member ^= __luainspector_mix(rows[i].type);  // a value that changed type keeps its id
+        if (column >= 2) member ^= rows[i].fingerprint ^ rows[i].child_count;
+        members += __luainspector_mix(member);
+        layout = (layout ^ rows[i].id) * 1099511628211ull;
+    }
+
+    sort_order& o = m_sort_orders[t.id];
+    o.used = m_sort_stamp;
+    if (o.members == members && o.layout == layout) return o.order;
+    if (o.members == members && o.ids.size() == t.child_count) {
+        m_sort_positions.clear();
+        for (std::uint32_t k = 0; k < t.child_count; ++k) m_sort_positions.insert(rows[t.child_begin + k].id, k);
+        bool found = true;
+        for (std::size_t k = 0; k < o.ids.size() && found; ++k) {
+            o.order[k] = m_sort_positions.find(o.ids[k]);
+            found = o.order[k] != luainspector_ptr_map::kNone;
+        }
+        if (found) {
+            o.layout = layout;
+            return o.order;
+        }
+    }
+
+    // Strings sort by their bytes. A row only holds the start of a long or binary string, the rest is read from
+    // its table, which stays on the stack and keeps the strings alive while sorting.
+    const int oldtop = L ? lua_gettop(L) : 0;
+    bool have_table = false;
+    if (column == 2 && L && t.child_count > 0 && lua_checkstack(L, 3)) have_table = push_row_table(L, rows[t.child_begin]);
+
+    m_sort_keys.clear();
+    for (std::uint32_t k = 0; k < t.child_count; ++k) {
+        const inspect_table_row& r = rows[t.child_begin + k];
+        const char* name = m_snapshot.name(r);
+        sort_key key{};
+        key.offset = k;
+        key.rank = r.type == kRowSummary ? 0 : r.type == kRowPage ? 1 : 2;
+        if (std::isdigit(static_cast<unsigned char>(name[0])) || (name[0] == '-' && std::isdigit(static_cast<unsigned char>(name[1])))) {
+            char* end;
+            key.name_number = std::strtod(name, &end);
+            key.numeric_name = *end == '\0';
+        }
+        if (column == 2 && r.type == LUA_TNUMBER) key.value = r.number;
+        if (column == 2 && r.type == LUA_TBOOLEAN) key.value = r.boolean;
+        if (column == 2 && r.type == LUA_TSTRING) {
+            // A string that cannot be read any more sorts by its preview
+            key.string = m_snapshot.text.data() + r.preview_off;
+            key.string_len = r.long_string ? r.preview_len : r.length;
+            if (r.long_string && have_table && push_row_key(L, r)) {
+                if (lua_rawget(L, oldtop + 1) == LUA_TSTRING) key.string = lua_tolstring(L, -1, &key.string_len);
+                lua_pop(L, 1);
+            }
+        }
+        if (column == 3) key.value = r.type == LUA_TSTRING ? static_cast<double>(r.length) : r.type == LUA_TTABLE ? r.child_count : 0.0;
+        m_sort_keys.push_back(key);
+    }
+
+    auto by_name = [this, &rows, &t](const sort_key& a, const sort_key& b) -> int {
+        if (a.numeric_name != b.numeric_name) return a.numeric_name ? -1 : 1;
+        if (a.numeric_name) return __luainspector_cmp_number(a.name_number, b.name_number);
+        return std::strcmp(m_snapshot.name(rows[t.child_begin + a.offset]), m_snapshot.name(rows[t.child_begin + b.offset]));
+    };
+    auto by_column = [&rows, &t, column, &by_name](const sort_key& a, const sort_key& b) -> int {
+        const inspect_table_row& ra = rows[t.child_begin + a.offset];
+        const inspect_table_row& rb = rows[t.child_begin + b.offset];
+        switch (column) {
+            case 1:
+                return static_cast<int>(ra.type) - static_cast<int>(rb.type);
+            case 2:
+                if (ra.type != rb.type) return static_cast<int>(ra.type) - static_cast<int>(rb.type);
+                if (ra.type == LUA_TSTRING) {
+                    const int c = std::memcmp(a.string, b.string, std::min(a.string_len, b.string_len));
+                    return c != 0 ? c : a.string_len < b.string_len ? -1 : a.string_len > b.string_len ? 1 : 0;
                 }
-                ImGui::TextUnformatted(buf.data(), buf.data() + size);
-                ImGui::PopStyleColor(pop_count);
+                if (ra.type == LUA_TNUMBER || ra.type == LUA_TBOOLEAN) return __luainspector_cmp_number(a.value, b.value);
+                return std::less<const void*>()(ra.pointer, rb.pointer) ? -1 : ra.pointer == rb.pointer ? 0 : 1;
+            case 3:
+                return __luainspector_cmp_number(a.value, b.value);
+            default:
+                return by_name(a, b);
+        }
+    };
+    std::sort(m_sort_keys.begin(), m_sort_keys.end(), [&](const sort_key& a, const sort_key& b) {
+        if (a.rank != b.rank) return a.rank < b.rank;
+        if (a.rank < 2) return a.offset < b.offset;
+        int c = by_column(a, b);
+        if (c != 0) return ascending ? c < 0 : c > 0;
+        c = by_name(a, b);
+        return c != 0 ? c < 0 : a.offset < b.offset;
+    });
+    if (L) lua_settop(L, oldtop);
+
+    o.ids.resize(m_sort_keys.size());
+    o.order.resize(m_sort_keys.size());
+    for (std::size_t k = 0; k < m_sort_keys.size(); ++k) {
+        o.order[k] = m_sort_keys[k].offset;
+        o.ids[k] = rows[t.child_begin + m_sort_keys[k].offset].id;
+    }
+    o.members = members;
+    o.layout = layout;
+    return o.order;
+}
+
+// Flatten the snapshot into draw order, expanded nodes are followed by the run of their children. While a
+// search has results only the matches, their ancestors and whatever is opened below a match are listed.
+void neko::luainspector::build_visible_rows(const inspect_table_config& cfg) {
+    const auto& rows = m_snapshot.rows;
+    m_visible_rows.clear();
+    m_visible_stack.clear();
+    if (rows.empty()) return;
+
+    const bool searching = cfg.search_str != 0 && cfg.search_str[0] != '\0';
+    const bool indexed = searching && m_search_result.index != nullptr;
+
+    // Children come after their parent, so one backward pass marks every row with a recent change below it
+    if (cfg.changed_only) {
+        const double now = ImGui::GetTime();
+        m_row_hot.assign(rows.size(), 0);
+        for (std::size_t i = rows.size(); i-- > 0;) {
+            std::uint8_t hot = now - rows[i].changed < kChurnWindow;
+            if (rows[i].child_slot != 0) {
+                for (std::uint32_t c = rows[i].child_begin; c < rows[i].child_begin + rows[i].child_count; ++c) hot |= m_row_hot[c];
             }
+            m_row_hot[i] = hot;
+        }
+    }
 
-            if (ImGui::IsKeyDown(ImGuiKey_Enter)) {
-                cmd.clear();
+    ++m_sort_stamp;
+    auto push_children = [this, &rows](std::uint32_t parent, std::uint32_t flags) {
+        if (m_sort_column < 0) {
+            for (std::uint32_t i = rows[parent].child_count; i > 0; --i) m_visible_stack.push_back((rows[parent].child_begin + i - 1) | flags);
+            return;
+        }
+        const std::vector<std::uint32_t>& order = sorted_children(parent);
+        for (std::size_t i = order.size(); i > 0; --i) m_visible_stack.push_back((rows[parent].child_begin + order[i - 1]) | flags);
+    };
+    push_children(0, 0);
+
+    while (!m_visible_stack.empty()) {
+        const std::uint32_t entry = m_visible_stack.back();
+        const std::uint32_t i = entry & ~kRowInMatch;
+        m_visible_stack.pop_back();
+        const inspect_table_row& row = rows[i];
+
+        std::uint32_t child_flags = entry & kRowInMatch;
+        if (indexed) {
+            const bool match = m_search_matches.count(row.id) != 0;
+            if (!child_flags && !match && !m_search_expanded.count(row.id)) continue;
+            if (match) child_flags = kRowInMatch;
+        } else if (searching && !strstr(m_snapshot.name(row), cfg.search_str)) {
+            continue;  // index not built yet, filter on the key like a plain search
+        }
+        if (cfg.is_non_function && row.type == LUA_TFUNCTION) continue;
+        if (cfg.changed_only && !m_row_hot[i]) continue;
+
+        m_visible_rows.push_back(i);
+        if (!is_row_open(row.id)) continue;
+
+        if (row.type == LUA_TTABLE || row.type == kRowPage) {
+            if (row.child_slot != 0) {
+                push_children(i, child_flags);
+            } else if (!row.back_ref && !row.too_deep) {
+                m_snapshot.dirty = true;  // expanded since the last refresh
             }
+        } else if (row.type == LUA_TSTRING || row.type == LUA_TNUMBER || row.type == LUA_TUSERDATA) {
+            if (row.key_type > LUA_TSTRING && row.key.slot == 0) m_snapshot.dirty = true;  // its key gets anchored by the next walk
+            m_visible_rows.push_back(i | kRowEditor);
+        }
+    }
+
+    // Orders of tables no longer open or no longer in the snapshot
+    for (auto it = m_sort_orders.begin(); it != m_sort_orders.end();) {
+        if (it->second.used != m_sort_stamp) {
+            it = m_sort_orders.erase(it);
+        } else {
+            ++it;
         }
-        ImGui::End();
-        ImGui::PopStyleVar();
     }
+
+    m_visible_dirty = false;
 }
 
-void neko::luainspector::display(bool* textbox_react) noexcept {
+// Push the table a row lives in, returns false (nothing pushed) if it is no longer anchored
+bool neko::luainspector::push_row_table(lua_State* L, const inspect_table_row& row) {
+    lua_pushlightuserdata(L, __neko_lua_inspector_rows_lightkey());
+    lua_gettable(L, LUA_REGISTRYINDEX);
+    if (lua_type(L, -1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return false;
+    }
+    if (lua_rawgeti(L, -1, row.table_slot) != LUA_TTABLE) {
+        lua_pop(L, 2);
+        return false;
+    }
+    lua_remove(L, -2);  // anchor
+    return true;
+}
 
-    ImGui::PushStyleColor(ImGuiCol_ChildBg, ImVec4(0.1f, 0.1f, 0.1f, 1.0f));
+// Push the key of a row as the walk found it, returns false (nothing pushed) if it cannot be had any more
+bool neko::luainspector::push_row_key(lua_State* L, const inspect_table_row& row) {
+    switch (row.key_type) {
+        case LUA_TSTRING:
+            lua_pushlstring(L, m_snapshot.name(row), row.name_len);
+            return true;
+        case LUA_TNUMBER:
+            if (row.key_integer) {
+                lua_pushinteger(L, row.key.integer);
+            } else {
+                lua_pushnumber(L, row.key.number);
+            }
+            return true;
+        case LUA_TBOOLEAN:
+            lua_pushboolean(L, static_cast<int>(row.key.integer));
+            return true;
+        case LUA_TLIGHTUSERDATA:
+            lua_pushlightuserdata(L, reinterpret_cast<void*>(static_cast<std::intptr_t>(row.key.integer)));
+            return true;
+        default:
+            if (row.key_type <= LUA_TNIL || row.key.slot == 0) return false;
+            lua_pushlightuserdata(L, __neko_lua_inspector_rows_lightkey());
+            lua_rawget(L, LUA_REGISTRYINDEX);
+            if (lua_type(L, -1) != LUA_TTABLE) {
+                lua_pop(L, 1);
+                return false;
+            }
+            lua_rawgeti(L, -1, row.key.slot);
+            lua_remove(L, -2);
+            return true;
+    }
+}
 
-    ImVec2 size = ImVec2(ImGui::GetContentRegionAvail().x, ImGui::GetWindowSize().y - 125);
-    if (ImGui::BeginChild("##console_log", size)) {
-        ImGui::PushTextWrapPos(ImGui::GetContentRegionAvail().x);
+void neko::luainspector::draw_table_row(const inspect_table_row& row) {
+    static ImGuiTreeNodeFlags tree_node_flags = ImGuiTreeNodeFlags_SpanAllColumns | ImGuiTreeNodeFlags_NoTreePushOnOpen;
+    static ImGuiTreeNodeFlags leaf_flags = tree_node_flags | ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_Bullet;
+
+    const char* name = m_snapshot.name(row);
+    const float indent = row.depth * ImGui::GetStyle().IndentSpacing;
+
+    ImGui::TableNextRow();
+    const double age = ImGui::GetTime() - row.changed;
+    if (age < kChangeFade) ImGui::TableSetBgColor(ImGuiTableBgTarget_RowBg1, IM_COL32(255, 160, 0, static_cast<int>(110.0 * (1.0 - age / kChangeFade))));
+    ImGui::TableNextColumn();
+    if (indent > 0.f) ImGui::Indent(indent);
+
+    const bool openable = row.type == LUA_TSTRING || row.type == LUA_TNUMBER || row.type == LUA_TTABLE || row.type == LUA_TUSERDATA || row.type == kRowPage;
+    if (openable) {
+        const bool was_open = is_row_open(row.id);
+        ImGui::SetNextItemOpen(was_open);
+        const bool open = ImGui::TreeNodeEx(reinterpret_cast<const void*>(static_cast<std::uintptr_t>(row.id)), tree_node_flags, "%s", name);
+        if (open != was_open) {
+            if (open) {
+                m_open_rows.insert(row.id);
+            } else {
+                m_open_rows.erase(row.id);
+                m_search_expanded.erase(row.id);
+                if (m_edit_row == row.id) {
+                    m_edit_row = 0;
+                    std::string().swap(m_edit_buffer);
+                }
+            }
+            m_visible_dirty = true;
+        }
+    } else {
+        ImGui::TreeNodeEx(reinterpret_cast<const void*>(static_cast<std::uintptr_t>(row.id)), leaf_flags, "%s", name);
+    }
+    if ((row.type == LUA_TTABLE || row.type == LUA_TFUNCTION || row.type == LUA_TUSERDATA || row.type == LUA_TTHREAD) && ImGui::BeginPopupContextItem()) {
+        if (ImGui::MenuItem("Who keeps this alive?")) {
+            m_retain_ptr = row.pointer;
+            m_retain_dirty = true;
+            m_retain_open = true;
+        }
+        ImGui::EndPopup();
+    }
 
-        for (auto& a : messageLog) {
-            ImVec4 colour;
-            switch (a.second) {
-                case LUACON_LOG_TYPE_WARNING:
-                    colour = {1.0f, 1.0f, 0.0f, 1.0f};
-                    break;
-                case LUACON_LOG_TYPE_ERROR:
-                    colour = {1.0f, 0.0f, 0.0f, 1.0f};
-                    break;
-                case LUACON_LOG_TYPE_NOTE:
-                    colour = {0.13f, 0.44f, 0.61f, 1.0f};
-                    break;
-                case LUACON_LOG_TYPE_SUCCESS:
-                    colour = {0.0f, 1.0f, 0.0f, 1.0f};
-                    break;
-                case LUACON_LOG_TYPE_MESSAGE:
-                    colour = {1.0f, 1.0f, 1.0f, 1.0f};
-                    break;
+    if (indent > 0.f) ImGui::Unindent(indent);
+
+    ImGui::TableNextColumn();
+    switch (row.type) {
+        case LUA_TSTRING:
+        case LUA_TNUMBER:
+        case LUA_TFUNCTION:
+        case LUA_TTABLE:
+        case LUA_TUSERDATA:
+        case LUA_TBOOLEAN:
+            ImGui::TextDisabled("%s", lua_typename(nullptr, row.type));
+            break;
+        case kRowPage:
+            ImGui::TextDisabled("page");
+            break;
+        case kRowSummary:
+            ImGui::TextDisabled("summary");
+            break;
+        default:
+            ImGui::TextColored(rgba_to_imvec(240, 0, 0, 255), "Unknown");
+            break;
+    }
+    ImGui::TableNextColumn();
+
+    switch (row.type) {
+        case LUA_TSTRING:
+            if (row.binary_string) {
+                ImGui::TextColored(rgba_to_imvec(40, 220, 55, 255), "<binary, %llu bytes>", static_cast<unsigned long long>(row.length));
+            } else if (row.long_string) {
+                ImGui::TextColored(rgba_to_imvec(40, 220, 55, 255), "\"%.*s...\" (%llu bytes)", static_cast<int>(row.preview_len), m_snapshot.text.data() + row.preview_off,
+                                   static_cast<unsigned long long>(row.length));
+            } else {
+                ImGui::TextColored(rgba_to_imvec(40, 220, 55, 255), "\"%.*s\"", static_cast<int>(row.preview_len), m_snapshot.text.data() + row.preview_off);
+            }
+            break;
+        case LUA_TNUMBER:
+            ImGui::Text("%f", row.number);
+            break;
+        case LUA_TFUNCTION:
+            ImGui::TextColored(rgba_to_imvec(110, 180, 255, 255), "%p", row.pointer);
+            break;
+        case LUA_TTABLE:
+            if (row.back_ref) {
+                ImGui::PushID(reinterpret_cast<const void*>(static_cast<std::uintptr_t>(row.id)));
+                if (ImGui::SmallButton("shown above")) jump_to_first(row);
+                ImGui::PopID();
+            } else if (row.too_deep) {
+                ImGui::TextDisabled("depth limit");
+            } else {
+                ImGui::TextDisabled("--");
+            }
+            break;
+        case LUA_TUSERDATA:
+            ImGui::TextColored(rgba_to_imvec(75, 230, 250, 255), "%p", row.pointer);
+            break;
+        case LUA_TBOOLEAN:
+            ImGui::TextColored(rgba_to_imvec(220, 160, 40, 255), "%s", neko_bool_str(row.boolean));
+            break;
+        case kRowPage:
+            ImGui::TextDisabled("%u elements", static_cast<unsigned>(row.page.last - row.page.first + 1));
+            break;
+        case kRowSummary: {
+            const inspect_sequence_summary& s = m_snapshot.summaries[row.summary];
+            if (!s.numeric) {
+                ImGui::TextDisabled("not all numbers");
+            } else if (s.nan == s.count) {
+                ImGui::Text("%lld NaN", static_cast<long long>(s.nan));
+            } else {
+                ImGui::Text("min %g  max %g  mean %g  NaN %lld", s.min, s.max, s.sum / static_cast<double>(s.count - s.nan), static_cast<long long>(s.nan));
             }
-            ImGui::TextColored(colour, "%s", a.first.c_str());
+            break;
         }
-        ImGui::PopTextWrapPos();
+        default:
+            ImGui::Text("Unknown");
+            break;
+    }
 
-        if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
-            ImGui::SetScrollHereY(1.0f);
+    // Bytes of a string, entries of a walked table or a page
+    ImGui::TableNextColumn();
+    if (row.type == LUA_TSTRING) {
+        ImGui::TextDisabled("%llu", static_cast<unsigned long long>(row.length));
+    } else if ((row.type == LUA_TTABLE && row.child_slot != 0) || row.type == kRowPage) {
+        ImGui::TextDisabled("%u", row.type == kRowPage ? static_cast<unsigned>(row.page.last - row.page.first + 1) : row.child_count);
+    }
+}
+
+// Queue a write to the row, whose owning table is at index table. The caller fills in the value. Returns
+// nullptr if the key cannot be pushed any more.
+neko::luainspector_edit* neko::luainspector::queue_edit(lua_State* L, const inspect_table_row& row, int table) {
+    table = lua_absindex(L, table);
+    for (luainspector_edit& e : m_edits) {
+        if (e.row == row.id) return &e;
+    }
+    if (!push_row_key(L, row)) return nullptr;
+
+    luainspector_edit e{};
+    e.row = row.id;
+    e.key_type = row.key_type;
+    e.key_integer = row.key_integer;
+    e.key = row.key;
+    if (row.key_type == LUA_TSTRING) e.key_text.assign(m_snapshot.name(row), row.name_len);
+
+    __luainspector_push_scratch(L, __neko_lua_inspector_edits_lightkey());
+    e.table_slot = static_cast<std::int32_t>(lua_rawlen(L, -1)) + 1;
+    lua_pushvalue(L, table);
+    lua_rawseti(L, -2, e.table_slot);
+    if (row.key_type > LUA_TSTRING) {
+        e.key.slot = e.table_slot + 1;
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, -2, e.key.slot);
+    }
+    lua_pop(L, 2);  // anchor and key
+
+    m_edits.push_back(std::move(e));
+    return &m_edits.back();
+}
+
+// Apply the queued Registry edits with lua_rawset, in the order they were made, and refresh the view. Call it
+// between update steps, outside any traversal of the tables involved; by default luainspector_draw calls it once
+// drawing is done. A walk spread over frames may still be inside an edited table, which is fine since an edit
+// only assigns to a key the walk has already seen. Returns the number of writes.
+std::size_t neko::luainspector::apply_edits(lua_State* L) {
+    if (m_edits.empty() || !lua_checkstack(L, 4)) return 0;
+
+    std::size_t applied = 0;
+    __luainspector_push_scratch(L, __neko_lua_inspector_edits_lightkey());
+    for (const luainspector_edit& e : m_edits) {
+        if (lua_rawgeti(L, -1, e.table_slot) != LUA_TTABLE) {
+            lua_pop(L, 1);
+            continue;
+        }
+        switch (e.key_type) {
+            case LUA_TSTRING:
+                lua_pushlstring(L, e.key_text.data(), e.key_text.size());
+                break;
+            case LUA_TNUMBER:
+                if (e.key_integer) {
+                    lua_pushinteger(L, e.key.integer);
+                } else {
+                    lua_pushnumber(L, e.key.number);
+                }
+                break;
+            case LUA_TBOOLEAN:
+                lua_pushboolean(L, static_cast<int>(e.key.integer));
+                break;
+            case LUA_TLIGHTUSERDATA:
+                lua_pushlightuserdata(L, reinterpret_cast<void*>(static_cast<std::intptr_t>(e.key.integer)));
+                break;
+            default:
+                lua_rawgeti(L, -2, e.key.slot);
+                break;
+        }
+        if (e.value_type == LUA_TSTRING) {
+            lua_pushlstring(L, e.text.data(), e.text.size());
+        } else {
+            lua_pushnumber(L, e.number);
+        }
+        lua_rawset(L, -3);
+        lua_pop(L, 1);  // table
+        ++applied;
+    }
+    __luainspector_clear_slots(L, -1, static_cast<lua_Integer>(lua_rawlen(L, -1)));
+    lua_pop(L, 1);
+
+    m_edits.clear();
+    m_snapshot.dirty = true;
+    return applied;
+}
+
+// The editor of an open string/number/userdata row is a line of its own so the flat list stays clippable
+void neko::luainspector::draw_table_row_editor(lua_State* L, const inspect_table_row& row) {
+    const float indent = (row.depth + 1) * ImGui::GetStyle().IndentSpacing;
+    const char* name = m_snapshot.name(row);
+
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::PushID(reinterpret_cast<const void*>(static_cast<std::uintptr_t>(row.id)));
+    ImGui::Indent(indent);
+
+    if (!push_row_table(L, row)) {
+        ImGui::TextDisabled("(gone)");
+    } else if (!push_row_key(L, row)) {
+        lua_pop(L, 1);
+        ImGui::TextDisabled("(gone)");
+    } else {
+        // Raw access with the original key, the way the walk read it
+        lua_rawget(L, -2);  // # -1 value, # -2 owning table
+
+        if (row.type == LUA_TSTRING && lua_type(L, -1) == LUA_TSTRING) {
+            std::size_t len;
+            lua_tolstring(L, -1, &len);
+            if (m_edit_row == row.id) {
+                ImGui::InputTextMultiline("value", m_edit_buffer.data(), m_edit_buffer.capacity() + 1, ImVec2(-1.f, ImGui::GetTextLineHeight() * 6),
+                                          ImGuiInputTextFlags_CallbackResize, __luainspector_string_resize, &m_edit_buffer);
+                const bool apply = ImGui::Button("Apply");
+                ImGui::SameLine();
+                const bool cancel = ImGui::Button("Cancel");
+                if (apply) {
+                    if (luainspector_edit* e = queue_edit(L, row, -2)) {
+                        e->value_type = LUA_TSTRING;
+                        e->text.assign(m_edit_buffer.data(), m_edit_buffer.size());
+                    }
+                }
+                if (apply || cancel) {
+                    m_edit_row = 0;
+                    std::string().swap(m_edit_buffer);
+                }
+            } else {
+                ImGui::Text("%zu bytes", len);
+                ImGui::SameLine();
+                if (ImGui::SmallButton("View")) open_string_viewer(L, -1, name);
+                if (!row.binary_string && len <= kMaxEditBytes) {
+                    ImGui::SameLine();
+                    if (ImGui::SmallButton("Edit")) {
+                        m_edit_row = row.id;
+                        m_edit_buffer.assign(lua_tostring(L, -1), len);
+                    }
+                }
+            }
+        } else if (row.type == LUA_TNUMBER && lua_type(L, -1) == LUA_TNUMBER) {
+            auto v = neko_lua_to<double>(L, -1);
+            // Once per press of Enter, holding it does not write again every frame
+            if (ImGui::InputDouble("value", &v, 0.0, 0.0, "%.6f", ImGuiInputTextFlags_EnterReturnsTrue) && v != neko_lua_to<double>(L, -1)) {
+                if (luainspector_edit* e = queue_edit(L, row, -2)) {
+                    e->value_type = LUA_TNUMBER;
+                    e->number = v;
+                }
+            }
+        } else if (row.type == LUA_TUSERDATA && lua_type(L, -1) == LUA_TUSERDATA) {
+            ImGui::Text("lua_v: %p", lua_topointer(L, -1));
+            ImGui::SameLine();
+            if (lua_getmetatable(L, -1)) {
+                lua_pushstring(L, "__name");
+                lua_gettable(L, -2);
+                if (lua_isstring(L, -1)) {
+                    const char* name = lua_tostring(L, -1);
+                    ImGui::Text("__name: %s", name);
+                } else {
+                    ImGui::Text("__name field is not a string!");
+                }
+                // pop __name value and table
+                lua_pop(L, 2);
+            } else {
+                ImGui::TextColored(rgba_to_imvec(240, 0, 0, 255), "Unknown Metatable");
+            }
         }
+        lua_pop(L, 2);  // value and owning table
     }
-    ImGui::EndChild();
 
-    ImGui::PopStyleColor();
+    ImGui::Unindent(indent);
+    ImGui::PopID();
+    ImGui::TableNextColumn();
+    ImGui::TableNextColumn();
+}
 
-    if (m_should_take_focus) {
-        ImGui::SetKeyboardFocusHere();
-        m_should_take_focus = false;
+// Inspect the table at the top of the stack. Rows come from the snapshot, which is only refreshed from
+// the Lua heap every cfg.refresh_interval seconds or when marked dirty, in slices of at most
+// cfg.walk_budget_us per frame, and are drawn through ImGuiListClipper so ImGui work scales with the
+// rows on screen.
+void neko::luainspector::inspect_table(lua_State* L, inspect_table_config& cfg) {
+    update_search(L, cfg);
+
+    if (!m_walking && (m_snapshot.dirty || (cfg.auto_refresh && ImGui::GetTime() - m_snapshot.time >= cfg.refresh_interval))) {
+        begin_snapshot(L);
+    }
+    if (m_walking) walk_snapshot(L, cfg.walk_budget_us);
+
+    // Clicking a header only changes the order the children are listed in, see sorted_children()
+    ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs();
+    if (specs && specs->SpecsDirty) {
+        m_sort_column = specs->SpecsCount > 0 ? specs->Specs[0].ColumnIndex : -1;
+        m_sort_ascending = specs->SpecsCount == 0 || specs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+        specs->SpecsDirty = false;
+        m_visible_dirty = true;
     }
 
-    ImGui::PushItemWidth(-1.f);
-    if ((this->command_line_input("##Input", &cmd, ImGuiInputTextFlags_CallbackCompletion | ImGuiInputTextFlags_CallbackHistory) || ImGui::IsItemActive()) && textbox_react != nullptr) {
-        *textbox_react = true;
+    if (m_visible_dirty) build_visible_rows(cfg);
+
+    // A jump waits until the walk has reached the row, then scrolls it into the middle
+    int scroll_to = -1;
+    if (m_scroll_to_row != 0) {
+        for (std::size_t i = 0; i < m_visible_rows.size(); ++i) {
+            if (!(m_visible_rows[i] & kRowEditor) && m_snapshot.rows[m_visible_rows[i]].id == m_scroll_to_row) {
+                scroll_to = static_cast<int>(i);
+                break;
+            }
+        }
+        if (scroll_to >= 0 || ImGui::GetTime() > m_scroll_deadline) m_scroll_to_row = 0;
     }
-    ImGui::PopItemWidth();
 
-    if (m_input_text_id == 0u) {
-        m_input_text_id = ImGui::GetItemID();
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(m_visible_rows.size()));
+    if (scroll_to >= 0) clipper.IncludeItemByIndex(scroll_to);
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const std::uint32_t entry = m_visible_rows[i];
+            if (entry & kRowEditor) {
+                draw_table_row_editor(L, m_snapshot.rows[entry & ~kRowEditor]);
+            } else {
+                draw_table_row(m_snapshot.rows[entry]);
+            }
+            if (i == scroll_to) ImGui::SetScrollHereY(0.5f);
+        }
     }
+    clipper.End();
+}
 
-    auto call_command = [&]() {
-        if (!m_history.empty() && m_history.back() != cmd) {
-            m_history.push_back(cmd);
-            m_history.erase(m_history.begin());
+// Scroll to the row a back reference stands for, the first path the walk reached its table by
+void neko::luainspector::jump_to_first(const inspect_table_row& row) {
+    for (std::size_t i = 1; i < m_snapshot.rows.size(); ++i) {
+        const inspect_table_row& r = m_snapshot.rows[i];
+        if (r.type == LUA_TTABLE && r.child_slot != 0 && r.pointer == row.pointer) {
+            m_scroll_to_row = r.id;
+            m_scroll_deadline = ImGui::GetTime() + 1.0;
+            return;
         }
+    }
+    ImGui::SetScrollY(0.0f);  // the root
+}
 
-        m_hindex = m_history.size();
+// Open the way down to an index entry in the Registry view and scroll to it once it has been walked
+void neko::luainspector::jump_to_entry(const luainspector_search_index& index, std::uint32_t entry) {
+    for (std::uint32_t e = entry; e != luainspector_search_index::kNoParent; e = index.entries[e].parent) m_open_rows.insert(index.entries[e].id);
+    if (entry != luainspector_search_index::kNoParent) open_pages(index, entry, m_open_rows);
+    m_scroll_to_row = entry == luainspector_search_index::kNoParent ? 0 : index.entries[entry].id;
+    m_scroll_deadline = ImGui::GetTime() + 5.0;
+    m_search_text[0] = '\0';  // a search could hide it
+    m_search_dirty = true;
+    m_snapshot.dirty = true;
+    m_visible_dirty = true;
+    select_tab("Registry");
+}
 
-        if (L) {
-            const int oldtop = lua_gettop(L);
-            bool evalok = try_eval(cmd, true) || try_eval(cmd, false);
+// Biggest tables reachable from _G, from the stats the index walk gathers
+void neko::luainspector::draw_tables(lua_State* L) {
+    constexpr std::size_t kTop = 500;
+    inspect_table_config& cfg = m_table_config;
 
-            if (evalok && LUA_OK == lua_pcall(L, 0, LUA_MULTRET, 0)) {
-                if (oldtop != lua_gettop(L)) print_luastack(oldtop + 1, lua_gettop(L), LUACON_LOG_TYPE_MESSAGE);
+    lua_pushglobaltable(L);
+    update_index(L, cfg);
+    lua_pop(L, 1);
+
+    if (ImGui::Button("Refresh") && !m_index_pending) m_index_time = ImGui::GetTime() - cfg.search_index_interval;
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(120.0f);
+    ImGui::DragFloat("Interval", &cfg.search_index_interval, 0.1f, 0.5f, 600.0f, "%.1f s");
+    ImGui::SameLine();
+    if (m_index_pending) {
+        ImGui::Text("walking... %zu tables", m_index_pending->tables.size());
+    } else if (m_search_index) {
+        ImGui::Text("%zu tables, %.1fs ago", m_search_index->tables.size(), ImGui::GetTime() - m_index_time);
+    }
+    if (!m_search_index) return;
+    const luainspector_search_index& index = *m_search_index;
+
+    const ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_BordersV | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY;
+    if (!ImGui::BeginTable("lua_tables", 5, flags)) return;
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Path", ImGuiTableColumnFlags_NoSort);
+    ImGui::TableSetupColumn("Entries");
+    ImGui::TableSetupColumn("Array");
+    ImGui::TableSetupColumn("Hash");
+    ImGui::TableSetupColumn("Bytes", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending);
+    ImGui::TableHeadersRow();
+
+    ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs();
+    if (specs && (specs->SpecsDirty || m_table_order_index != &index)) {
+        const int column = specs->SpecsCount > 0 ? specs->Specs[0].ColumnIndex : 4;
+        const bool ascending = specs->SpecsCount > 0 && specs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+        auto key = [&index, column](std::uint32_t i) -> std::uint64_t {
+            const luainspector_search_index::table_stats& t = index.tables[i];
+            switch (column) {
+                case 1:
+                    return static_cast<std::uint64_t>(t.array) + t.hash;
+                case 2:
+                    return t.array;
+                case 3:
+                    return t.hash;
+                default:
+                    return t.bytes;
+            }
+        };
+        m_table_order.resize(index.tables.size());
+        for (std::uint32_t i = 0; i < m_table_order.size(); ++i) m_table_order[i] = i;
+        const std::size_t top = std::min(kTop, m_table_order.size());
+        std::partial_sort(m_table_order.begin(), m_table_order.begin() + top, m_table_order.end(), [&](std::uint32_t a, std::uint32_t b) { return ascending ? key(a) < key(b) : key(a) > key(b); });
+        m_table_order.resize(top);
+        m_table_order_index = &index;
+        specs->SpecsDirty = false;
+    }
 
-                lua_settop(L, oldtop);
+    char path[512];
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(m_table_order.size()));
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const luainspector_search_index::table_stats& t = index.tables[m_table_order[i]];
+            if (t.entry == luainspector_search_index::kNoParent) {
+                std::snprintf(path, sizeof(path), "_G");
             } else {
-                const std::string err = adjust_error_msg(L, -1);
-                if (evalok || !neko::incomplete_chunk_error(err.c_str(), err.length())) {
-                    print_line(err, LUACON_LOG_TYPE_ERROR);
-                }
-                lua_pop(L, 1);
+                index.path(t.entry, path, sizeof(path));
             }
-        } else {
-            print_line("Lua state pointer is NULL, commands have no effect", LUACON_LOG_TYPE_ERROR);
-        }
-        cmd.clear();
-    };
-
-    if (m_previously_active_id == m_input_text_id && ImGui::GetActiveID() != m_input_text_id) {
-        if (ImGui::IsKeyDown(ImGuiKey_Enter)) {
-            call_command();
-            m_should_take_focus = true;
-        } else {
-            m_should_take_focus = false;
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::PushID(i);
+            if (ImGui::Selectable(path, false, ImGuiSelectableFlags_SpanAllColumns)) jump_to_entry(index, t.entry);
+            ImGui::PopID();
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(t.array) + t.hash);
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", t.array);
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", t.hash);
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(t.bytes));
         }
     }
-    m_previously_active_id = ImGui::GetActiveID();
+    ImGui::EndTable();
+}
 
-    if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) ImGui::SetScrollHereY(1.0f);
+int neko::luainspector::luainspector_init(lua_State* L) {
 
-    show_autocomplete();
+    void* model_mem = lua_newuserdata(L, sizeof(neko::luainspector));
+
+    neko::luainspector* inspector = new (model_mem) neko::luainspector();
+
+    inspector->setL(L);
+    inspector->m_history.resize(8);
+    inspector->m_log.reserve(luainspector_log::kDefaultBytes, luainspector_log::kDefaultEntries);
+
+    return 1;
+}
+
+int neko::luainspector::luainspector_get(lua_State* L) {
+    neko::luainspector* inspector = neko::luainspector::get_from_registry(L);
+    lua_pushlightuserdata(L, inspector);
+    return 1;
 }
 
-void neko::luainspector::print_line(const std::string& msg, luainspector_logtype type) noexcept { messageLog.emplace_back(msg, type); }
+void neko::luainspector_watch::push(float v) {
+    samples[head] = v;
+    head = (head + 1) % kHistory;
+    count = std::min(count + 1, kHistory);
+}
 
-void neko::luainspector::inspect_table(lua_State* L, inspect_table_config& cfg) {
-    auto is_multiline = [](const char* str) -> bool {
-        while (*str != '\0') {
-            if (*str == '\n') {
-                return true;
-            }
-            str++;
+// Reduce the samples to at most columns min/max pairs, oldest first, and their range. With fewer samples than
+// columns they are written as they are. Returns the number of values written.
+int neko::luainspector_watch::downsample(float* out, int columns, float& lo, float& hi) const {
+    lo = FLT_MAX;
+    hi = -FLT_MAX;
+    if (count <= static_cast<std::size_t>(columns)) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = at(i);
+            lo = std::min(lo, out[i]);
+            hi = std::max(hi, out[i]);
         }
-        return false;
-    };
+        return static_cast<int>(count);
+    }
+    for (int c = 0; c < columns; ++c) {
+        const std::size_t begin = count * c / columns;
+        const std::size_t end = count * (c + 1) / columns;
+        float mn = at(begin), mx = mn;
+        for (std::size_t i = begin + 1; i < end; ++i) {
+            const float v = at(i);
+            mn = std::min(mn, v);
+            mx = std::max(mx, v);
+        }
+        out[2 * c] = mn;
+        out[2 * c + 1] = mx;
+        lo = std::min(lo, mn);
+        hi = std::max(hi, mx);
+    }
+    return 2 * columns;
+}
 
-    lua_pushnil(L);
-    while (lua_next(L, -2) != 0) {
+void neko::luainspector::add_watch(std::string_view expr) {
+    if (expr.empty()) return;
+    luainspector_watch& w = m_watches.emplace_back();
+    const std::size_t len = std::min(expr.size(), sizeof(w.expr) - 1);
+    std::memcpy(w.expr, expr.data(), len);
+    w.expr[len] = '\0';
+    w.slot = ++m_watch_slot;
+    w.samples.resize(luainspector_watch::kHistory);
+}
 
-        if (lua_isnil(L, -2)) {
-            lua_pop(L, 2);
-            break;
-        }
+// Compile a watch into its slot of the registry watch table, as an expression or else as a statement
+bool neko::luainspector::compile_watch(lua_State* L, luainspector_watch& w) {
+    if (L != this->L) return false;
+    if (!try_eval(w.expr, true) && !try_eval(w.expr, false)) {
+        char buf[64];
+        const std::string_view err = adjust_error_msg(L, -1, buf, sizeof(buf));
+        std::snprintf(w.value, sizeof(w.value), "%.*s", static_cast<int>(err.size()), err.data());
+        w.error = true;
+        lua_pop(L, 1);
+        return false;
+    }
+    __luainspector_push_scratch(L, __neko_lua_inspector_watch_lightkey());
+    lua_insert(L, -2);
+    lua_rawseti(L, -2, w.slot);
+    lua_pop(L, 1);
+    w.compiled = true;
+    return true;
+}
 
-        bool edited = false;
-        auto name = neko_lua_to<const char*>(L, -2);
-        if (cfg.search_str != 0 && !strstr(name, cfg.search_str)) {
+// Evaluate every watch, at most m_watch_rate times a second whichever tab is open
+void neko::luainspector::sample_watches(lua_State* L) {
+    if (m_watches.empty()) return;
+    const double now = ImGui::GetTime();
+    if (now < m_watch_next) return;
+    const double interval = 1.0 / std::max(m_watch_rate, 0.1f);
+    m_watch_next = std::max(m_watch_next + interval, now);  // no burst after a stall
+
+    const int oldtop = lua_gettop(L);
+    __luainspector_push_scratch(L, __neko_lua_inspector_watch_lightkey());
+    const int table = lua_gettop(L);
+    for (luainspector_watch& w : m_watches) {
+        if (!w.compiled && !compile_watch(L, w)) continue;
+        lua_rawgeti(L, table, w.slot);
+        if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
+            char buf[64];
+            const std::string_view err = adjust_error_msg(L, -1, buf, sizeof(buf));
+            std::snprintf(w.value, sizeof(w.value), "%.*s", static_cast<int>(err.size()), err.data());
+            w.error = true;
             lua_pop(L, 1);
             continue;
         }
+        w.error = false;
+        switch (lua_type(L, -1)) {
+            case LUA_TNUMBER:
+                w.push(static_cast<float>(lua_tonumber(L, -1)));
+                std::snprintf(w.value, sizeof(w.value), "%.14g", lua_tonumber(L, -1));
+                break;
+            case LUA_TBOOLEAN:
+                w.push(lua_toboolean(L, -1) ? 1.0f : 0.0f);
+                std::snprintf(w.value, sizeof(w.value), "%s", lua_toboolean(L, -1) ? "true" : "false");
+                break;
+            case LUA_TSTRING: {
+                std::size_t len;
+                const char* str = lua_tolstring(L, -1, &len);
+                std::snprintf(w.value, sizeof(w.value), "\"%.*s\"", static_cast<int>(std::min<std::size_t>(len, sizeof(w.value) - 3)), str);
+                break;
+            }
+            case LUA_TNIL:
+                std::snprintf(w.value, sizeof(w.value), "nil");
+                break;
+            default:
+                std::snprintf(w.value, sizeof(w.value), "%s: %p", luaL_typename(L, -1), lua_topointer(L, -1));
+                break;
+        }
+        lua_pop(L, 1);
+    }
+    lua_settop(L, oldtop);
+}
 
-        int type = lua_type(L, -1);
+void neko::luainspector::draw_watches(lua_State* L) {
+    ImGui::SetNextItemWidth(-200.0f);
+    bool add = ImGui::InputTextWithHint("##watch_expr", "Expression to watch, e.g. player.x", m_watch_input, IM_ARRAYSIZE(m_watch_input), ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    add |= ImGui::Button("Watch");
+    if (add && m_watch_input[0] != '\0') {
+        add_watch(m_watch_input);
+        m_watch_input[0] = '\0';
+    }
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(100.0f);
+    ImGui::DragFloat("Rate", &m_watch_rate, 1.0f, 1.0f, 240.0f, "%.0f Hz");
 
-        if (cfg.is_non_function && type == LUA_TFUNCTION) {
-            goto skip;
+    if (!ImGui::BeginChild("##watches")) {
+        ImGui::EndChild();
+        return;
+    }
+    const int columns = std::clamp(static_cast<int>(ImGui::GetContentRegionAvail().x) / 2, 1, luainspector_watch::kPlotColumns);
+    for (std::size_t i = 0; i < m_watches.size();) {
+        luainspector_watch& w = m_watches[i];
+        ImGui::PushID(static_cast<int>(w.slot));
+        const bool remove = ImGui::SmallButton("x");
+        ImGui::SameLine();
+        if (ImGui::SmallButton("Clear")) w.clear();
+        ImGui::SameLine();
+        ImGui::TextUnformatted(w.expr);
+        ImGui::SameLine();
+        if (w.error) {
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "%s", w.value);
+        } else {
+            ImGui::TextColored(rgba_to_imvec(40, 220, 55, 255), "%s", w.value);
         }
 
-        ImGui::TableNextRow();
-        ImGui::TableNextColumn();
+        if (w.count > 0) {
+            float lo, hi;
+            const int n = w.downsample(m_watch_plot, columns, lo, hi);
+            char overlay[96];
+            std::snprintf(overlay, sizeof(overlay), "min %.6g  max %.6g  (%zu samples)", lo, hi, w.count);
+            ImGui::PlotLines("##plot", m_watch_plot, n, 0, overlay, lo, hi == lo ? lo + 1.0f : hi, ImVec2(-1.0f, 60.0f));
+        }
+        ImGui::PopID();
 
-        static ImGuiTreeNodeFlags tree_node_flags = ImGuiTreeNodeFlags_SpanAllColumns;
+        if (remove) {
+            __luainspector_push_scratch(L, __neko_lua_inspector_watch_lightkey());
+            lua_pushnil(L);
+            lua_rawseti(L, -2, w.slot);
+            lua_pop(L, 1);
+            m_watches.erase(m_watches.begin() + static_cast<std::ptrdiff_t>(i));
+        } else {
+            ++i;
+        }
+    }
+    ImGui::EndChild();
+}
 
-        if (type == LUA_TSTRING) {
+void neko::luainspector::draw_memory(lua_State* L) {
+    luainspector_memprof& prof = m_memprof;
+
+    bool tracking = prof.installed() && !m_command_owns_memprof;
+    if (ImGui::Checkbox("Track allocations", &tracking)) {
+        if (tracking) {
+            // Taken over from a running command, which keeps reading its counters
+            const bool command_owned = m_command_owns_memprof;
+            prof.install(L);
+            m_command_owns_memprof = false;
+            if (!update_hook()) {
+                prof.uninstall();
+                if (command_owned) m_command_owns_memprof = prof.install(L, true);
+                update_hook();
+                print_line("memory: another hook is installed on this state", LUACON_LOG_TYPE_ERROR);
+            }
+        } else {
+            prof.uninstall();
+            update_hook();
+        }
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Reset")) prof.reset();
+    ImGui::SameLine();
+    if (ImGui::Button("GC")) lua_gc(L, LUA_GCCOLLECT, 0);
+
+    const int kHistory = luainspector_memprof::kHistory;
+    const float heap_kb = prof.heap_history()[(prof.history_head() + kHistory - 1) % kHistory];
+    char overlay[64];
+    std::snprintf(overlay, sizeof(overlay), "%.2f mb", heap_kb / 1024.0f);
+    ImGui::PlotLines("Heap", prof.heap_history(), kHistory, prof.history_head(), overlay, 0.0f, FLT_MAX, ImVec2(0, 80.0f));
+
+    if (ImGui::CollapsingHeader("Heap snapshots")) draw_heap_snapshots(L);
+
+    if (!prof.installed() || m_command_owns_memprof) {
+        ImGui::TextDisabled("Allocation tracking is off");
+        return;
+    }
 
-            bool open = ImGui::TreeNodeEx(name, tree_node_flags);
-            ImGui::TableNextColumn();
-            ImGui::TextDisabled("%s", lua_typename(L, lua_type(L, -1)));
-            ImGui::TableNextColumn();
-            // ImGui::Text("%p", lua_topointer(L, -1));
-
-            const char* str_mem = neko_lua_to<const char*>(L, -1);
-            size_t buffer_size = 256;
-            for (; buffer_size < strlen(str_mem);) buffer_size += 128;
-            std::string v(neko_lua_to<const char*>(L, -1), buffer_size);
-            if (!is_multiline(str_mem) && strlen(str_mem) < 32) {
-                ImGui::TextColored(rgba_to_imvec(40, 220, 55, 255), "\"%s\"", str_mem);
-            } else {
-                ImGui::TextColored(rgba_to_imvec(40, 220, 55, 255), "\"...\"");
+    ImGui::PlotHistogram("Allocs/frame", prof.alloc_history(), kHistory, prof.history_head(), nullptr, 0.0f, FLT_MAX, ImVec2(0, 60.0f));
+    ImGui::Text("Live %.2f mb, peak %.2f mb", prof.live() / (1024.0 * 1024.0), prof.peak() / (1024.0 * 1024.0));
+    ImGui::Text("Allocs %llu, reallocs %llu, frees %llu", (unsigned long long)prof.allocs(), (unsigned long long)prof.reallocs(), (unsigned long long)prof.frees());
+
+    if (ImGui::CollapsingHeader("Size classes")) {
+        if (ImGui::BeginTable("memprof_classes", 3, ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_RowBg)) {
+            ImGui::TableSetupColumn("Size");
+            ImGui::TableSetupColumn("Count");
+            ImGui::TableSetupColumn("Bytes");
+            ImGui::TableHeadersRow();
+            for (int i = 0; i < luainspector_memprof::kSizeClasses; ++i) {
+                if (prof.class_count(i) == 0) continue;
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("<= %llu", 1ull << i);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long)prof.class_count(i));
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long)prof.class_bytes(i));
+            }
+            ImGui::EndTable();
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Top sources", ImGuiTreeNodeFlags_DefaultOpen)) {
+        const std::vector<luainspector_memprof::site>& sites = prof.sites();
+        constexpr std::size_t kTop = 32;
+        m_memprof_order.resize(sites.size());
+        for (std::uint32_t i = 0; i < sites.size(); ++i) m_memprof_order[i] = i;
+        const std::size_t top = std::min(kTop, sites.size());
+        std::partial_sort(m_memprof_order.begin(), m_memprof_order.begin() + top, m_memprof_order.end(),
+                          [&sites](std::uint32_t a, std::uint32_t b) { return sites[a].bytes > sites[b].bytes; });
+
+        if (ImGui::BeginTable("memprof_sites", 3, ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable)) {
+            ImGui::TableSetupColumn("Source");
+            ImGui::TableSetupColumn("Count");
+            ImGui::TableSetupColumn("Bytes");
+            ImGui::TableHeadersRow();
+            for (std::size_t i = 0; i < top; ++i) {
+                const luainspector_memprof::site& site = sites[m_memprof_order[i]];
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%s:%d", site.source, site.line);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long)site.count);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long)site.bytes);
             }
+            ImGui::EndTable();
+        }
+    }
+}
 
-            if (open) {
+void neko::luainspector::draw_heap_snapshots(lua_State* L) {
+    constexpr std::size_t kMaxSnapshots = 8;
+    const char* const kFile = "luainspector_heap.bin";
 
-                ImGui::InputTextMultiline("value", const_cast<char*>(v.c_str()), buffer_size);
-                if (ImGui::IsKeyDown(ImGuiKey_Enter) && v != neko_lua_to<const char*>(L, -1)) {
-                    edited = true;
-                    lua_pop(L, 1);                 // # -1 pop value
-                    lua_pushstring(L, v.c_str());  // # -1 push new value
-                    lua_setfield(L, -3, name);     // -3 table
-                }
+    auto keep = [this](std::unique_ptr<luainspector_heap_snapshot> snap) {
+        if (m_heap_snapshots.size() == kMaxSnapshots) m_heap_snapshots.erase(m_heap_snapshots.begin());
+        m_heap_snapshots.push_back(std::move(snap));
+        m_heap_after = static_cast<int>(m_heap_snapshots.size()) - 1;
+        m_heap_before = std::max(0, m_heap_after - 1);
+    };
+
+    if (ImGui::Button("Take snapshot")) {
+        auto snap = std::make_unique<luainspector_heap_snapshot>();
+        if (snap->capture(L)) {
+            snap->time = ImGui::GetTime();
+            keep(std::move(snap));
+        } else {
+            print_line("heap snapshot: out of Lua stack space", LUACON_LOG_TYPE_ERROR);
+        }
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Save last") && !m_heap_snapshots.empty()) {
+        if (!m_heap_snapshots.back()->save(kFile)) print_line("heap snapshot: cannot write luainspector_heap.bin", LUACON_LOG_TYPE_ERROR);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Load")) {
+        auto snap = std::make_unique<luainspector_heap_snapshot>();
+        if (snap->load(kFile)) {
+            keep(std::move(snap));
+        } else {
+            print_line("heap snapshot: cannot read luainspector_heap.bin", LUACON_LOG_TYPE_ERROR);
+        }
+    }
 
-                ImGui::TreePop();
+    for (std::size_t i = 0; i < m_heap_snapshots.size(); ++i) {
+        const luainspector_heap_snapshot& snap = *m_heap_snapshots[i];
+        ImGui::Text("#%zu  %.1fs  %zu objects, %zu edges, %.2f mb", i, snap.time, snap.objects.size(), snap.edges.size(), snap.total_size / (1024.0 * 1024.0));
+    }
+    if (m_heap_snapshots.size() < 2) return;
+
+    const int last = static_cast<int>(m_heap_snapshots.size()) - 1;
+    ImGui::SetNextItemWidth(80.0f);
+    ImGui::InputInt("Before", &m_heap_before);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(80.0f);
+    ImGui::InputInt("After", &m_heap_after);
+    m_heap_before = std::clamp(m_heap_before, 0, last);
+    m_heap_after = std::clamp(m_heap_after, 0, last);
+    ImGui::SameLine();
+    if (ImGui::Button("Diff")) m_heap_diff.compute(*m_heap_snapshots[m_heap_before], *m_heap_snapshots[m_heap_after]);
+
+    const std::vector<luainspector_heap_diff::group>& groups = m_heap_diff.groups;
+    if (groups.empty()) return;
+    const ImGuiTableFlags flags = ImGuiTableFlags_BordersV | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY;
+    if (ImGui::BeginTable("heap_diff", 6, flags, ImVec2(0.0f, ImGui::GetTextLineHeightWithSpacing() * 16))) {
+        ImGui::TableSetupScrollFreeze(0, 1);
+        ImGui::TableSetupColumn("Type");
+        ImGui::TableSetupColumn("Path");
+        ImGui::TableSetupColumn("New");
+        ImGui::TableSetupColumn("Freed");
+        ImGui::TableSetupColumn("Grown");
+        ImGui::TableSetupColumn("Net bytes");
+        ImGui::TableHeadersRow();
+
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(groups.size()));
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+                const luainspector_heap_diff::group& g = groups[i];
+                const std::string_view path = m_heap_diff.path(g);
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(lua_typename(L, g.type));
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(path.data(), path.data() + path.size());
+                ImGui::TableNextColumn();
+                ImGui::Text("%lld (%lld b)", static_cast<long long>(g.new_count), static_cast<long long>(g.new_bytes));
+                ImGui::TableNextColumn();
+                ImGui::Text("%lld (%lld b)", static_cast<long long>(g.freed_count), static_cast<long long>(g.freed_bytes));
+                ImGui::TableNextColumn();
+                ImGui::Text("%lld (%+lld b)", static_cast<long long>(g.grown_count), static_cast<long long>(g.grown_bytes));
+                ImGui::TableNextColumn();
+                ImGui::Text("%+lld", static_cast<long long>(g.new_bytes + g.grown_bytes - g.freed_bytes));
             }
+        }
+        ImGui::EndTable();
+    }
+}
 
-        } else if (type == LUA_TNUMBER) {
+// Pin the string at idx and show it in the viewer window. Text mode needs one pass to find the line starts,
+// hex mode none; either way a frame only touches the rows on screen.
+void neko::luainspector::open_string_viewer(lua_State* L, int idx, const char* title) {
+    idx = lua_absindex(L, idx);
+    lua_pushlightuserdata(L, __neko_lua_inspector_viewer_lightkey());
+    lua_pushvalue(L, idx);
+    lua_settable(L, LUA_REGISTRYINDEX);
 
-            bool open = ImGui::TreeNodeEx(name, tree_node_flags);
-            ImGui::TableNextColumn();
-            ImGui::TextDisabled("%s", lua_typename(L, lua_type(L, -1)));
-            ImGui::TableNextColumn();
-            ImGui::Text("%f", neko_lua_to<double>(L, -1));
+    m_viewer_str = lua_tolstring(L, idx, &m_viewer_len);
+    m_viewer_hex = is_binary_string(m_viewer_str, std::min<std::size_t>(m_viewer_len, 4096));
+    std::snprintf(m_viewer_title, sizeof(m_viewer_title), "%s", title);
+    m_viewer_open = true;
+
+    m_viewer_lines.clear();
+    std::size_t start = 0;
+    for (std::size_t i = 0; i <= m_viewer_len; ++i) {
+        if (i == m_viewer_len || m_viewer_str[i] == '\n' || i - start == kViewerLine) {
+            m_viewer_lines.push_back(static_cast<std::uint32_t>(start));
+            start = i < m_viewer_len && m_viewer_str[i] == '\n' ? i + 1 : i;
+        }
+    }
+}
 
-            if (open) {
-                auto v = neko_lua_to<double>(L, -1);
-                // ImGui::Text("lua_v: %f", v);
-                ImGui::InputDouble("value", &v);
-                if (ImGui::IsKeyDown(ImGuiKey_Enter) && v != neko_lua_to<double>(L, -1)) {
-                    edited = true;
-                    lua_pop(L, 1);              // # -1 pop value
-                    lua_pushnumber(L, v);       // # -1 push new value
-                    lua_setfield(L, -3, name);  // -3 table
+void neko::luainspector::draw_string_viewer(lua_State* L) {
+    ImGui::SetNextWindowSize(ImVec2(640.0f, 480.0f), ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("String viewer", &m_viewer_open)) {
+        ImGui::Text("%s: %zu bytes", m_viewer_title, m_viewer_len);
+        ImGui::SameLine();
+        ImGui::Checkbox("Hex", &m_viewer_hex);
+
+        ImGui::BeginChild("##viewer", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
+        ImGuiListClipper clipper;
+        if (m_viewer_hex) {
+            char line[96];
+            clipper.Begin(static_cast<int>((m_viewer_len + 15) / 16));
+            while (clipper.Step()) {
+                for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+                    const std::size_t off = static_cast<std::size_t>(r) * 16;
+                    const std::size_t n = std::min<std::size_t>(16, m_viewer_len - off);
+                    int len = std::snprintf(line, sizeof(line), "%08zx  ", off);
+                    for (std::size_t k = 0; k < 16; ++k) {
+                        len += k < n ? std::snprintf(line + len, sizeof(line) - len, "%02x ", static_cast<unsigned char>(m_viewer_str[off + k])) : std::snprintf(line + len, sizeof(line) - len, "   ");
+                    }
+                    line[len++] = ' ';
+                    for (std::size_t k = 0; k < n; ++k) {
+                        const unsigned char c = static_cast<unsigned char>(m_viewer_str[off + k]);
+                        line[len++] = c >= 0x20 && c < 0x7f ? static_cast<char>(c) : '.';
+                    }
+                    ImGui::TextUnformatted(line, line + len);
+                }
+            }
+        } else {
+            clipper.Begin(static_cast<int>(m_viewer_lines.size()));
+            while (clipper.Step()) {
+                for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+                    const std::size_t begin = m_viewer_lines[r];
+                    std::size_t end = r + 1 < static_cast<int>(m_viewer_lines.size()) ? m_viewer_lines[r + 1] : m_viewer_len;
+                    if (end > begin && m_viewer_str[end - 1] == '\n') --end;
+                    ImGui::TextUnformatted(m_viewer_str + begin, m_viewer_str + end);
                 }
-                ImGui::TreePop();
             }
+        }
+        clipper.End();
+        ImGui::EndChild();
+    }
+    ImGui::End();
 
-        } else if (type == LUA_TFUNCTION) {
-            ImGui::TreeNodeEx(name, tree_node_flags | ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_Bullet | ImGuiTreeNodeFlags_NoTreePushOnOpen);
-            ImGui::TableNextColumn();
-            ImGui::TextDisabled("%s", lua_typename(L, lua_type(L, -1)));
-            ImGui::TableNextColumn();
-            ImGui::TextColored(rgba_to_imvec(110, 180, 255, 255), "%p", lua_topointer(L, -1));
+    if (!m_viewer_open) {
+        lua_pushlightuserdata(L, __neko_lua_inspector_viewer_lightkey());
+        lua_pushnil(L);
+        lua_settable(L, LUA_REGISTRYINDEX);
+        m_viewer_str = nullptr;
+        m_viewer_len = 0;
+        std::vector<std::uint32_t>().swap(m_viewer_lines);
+    }
+}
 
-        } else if (type == LUA_TTABLE) {
-            // ImGui::Text("lua_v: %p", lua_topointer(L, -1));
-            // ImGui::Indent();
-            // inspect_table(L);
-            // ImGui::Unindent();
+// Retaining paths of one object, every step can be clicked to follow the chain further up
+void neko::luainspector::draw_retainers(lua_State* L) {
+    constexpr std::size_t kMaxPaths = 16;
+    const std::uint32_t kNoObject = luainspector_heap_snapshot::kNoObject;
 
-            bool open = ImGui::TreeNodeEx(name, tree_node_flags);
-            ImGui::TableNextColumn();
-            ImGui::TextDisabled("%s", lua_typename(L, lua_type(L, -1)));
-            ImGui::TableNextColumn();
-            ImGui::TextDisabled("--");
-            if (open) {
-                inspect_table(L, cfg);
-                ImGui::TreePop();
-            }
+    if (!ImGui::Begin("Retainers", &m_retain_open)) {
+        ImGui::End();
+        return;
+    }
 
-        } else if (type == LUA_TUSERDATA) {
+    const bool rebuild = ImGui::Button("Rebuild index");
+    if (rebuild || (m_retain_dirty && m_retention.empty())) {
+        if (!m_retention.build(L)) print_line("retainers: out of Lua stack space", LUACON_LOG_TYPE_ERROR);
+        m_retain_dirty = true;
+    }
+    ImGui::SameLine();
+    ImGui::Text("%zu objects, %zu references", m_retention.snapshot.objects.size(), m_retention.referrers.size());
 
-            bool open = ImGui::TreeNodeEx(name, tree_node_flags);
-            ImGui::TableNextColumn();
-            ImGui::TextDisabled("%s", lua_typename(L, lua_type(L, -1)));
-            ImGui::TableNextColumn();
-            ImGui::TextColored(rgba_to_imvec(75, 230, 250, 255), "%p", lua_topointer(L, -1));
+    const std::uint32_t target = m_retention.find(m_retain_ptr);
+    if (m_retain_dirty) {
+        m_retention.retainers(target, kMaxPaths, m_retain_steps, m_retain_paths);
+        m_retain_dirty = false;
+    }
+    if (target == kNoObject) {
+        ImGui::TextDisabled("Not in the index, it was created after the last rebuild or is already gone");
+        ImGui::End();
+        return;
+    }
 
-            if (open) {
+    const luainspector_heap_snapshot& snap = m_retention.snapshot;
+    char buf[512];
+    snap.path(target, buf, sizeof(buf));
+    ImGui::Text("%s %p  %s", lua_typename(L, snap.objects[target].type), m_retain_ptr, buf);
+    ImGui::Separator();
 
-                ImGui::Text("lua_v: %p", lua_topointer(L, -1));
-                if (lua_getmetatable(L, -1)) {
-                    lua_pushstring(L, "__name");
-                    lua_gettable(L, -2);
-                    if (lua_isstring(L, -1)) {
-                        const char* name = lua_tostring(L, -1);
-                        ImGui::Text("__name: %s", name);
-                    } else {
-                        ImGui::Text("__name field is not a string!");
-                    }
-                    // pop __name value and table
-                    lua_pop(L, 2);
-                } else {
-                    ImGui::TextColored(rgba_to_imvec(240, 0, 0, 255), "Unknown Metatable");
-                }
+    if (m_retention.is_root(target)) {
+        ImGui::TextDisabled("This is a root");
+    } else if (m_retain_paths.size() < 2) {
+        ImGui::TextDisabled("Held only through weak references or through itself");
+    }
 
-                ImGui::TreePop();
+    for (std::size_t k = 0; k + 1 < m_retain_paths.size(); ++k) {
+        ImGui::PushID(static_cast<int>(k));
+        ImGui::Bullet();
+        for (std::uint32_t j = m_retain_paths[k]; j < m_retain_paths[k + 1]; ++j) {
+            const luainspector_retention_index::step& step = m_retain_steps[j];
+            if (j == m_retain_paths[k]) {
+                snap.path(step.object, buf, sizeof(buf));
+            } else {
+                snap.format_label(m_retain_steps[j - 1].object, step.label, buf, sizeof(buf));
+                if (buf[0] != '[') {
+                    ImGui::SameLine(0.0f, 0.0f);
+                    ImGui::TextUnformatted(".");
+                }
             }
-        } else if (type == LUA_TBOOLEAN) {
-            ImGui::TreeNodeEx(name, tree_node_flags | ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_Bullet | ImGuiTreeNodeFlags_NoTreePushOnOpen);
-            ImGui::TableNextColumn();
-            ImGui::TextDisabled("%s", lua_typename(L, lua_type(L, -1)));
-            ImGui::TableNextColumn();
-            ImGui::TextColored(rgba_to_imvec(220, 160, 40, 255), "%s", neko_bool_str(lua_toboolean(L, -1)));
-        } else {
-            ImGui::TreeNodeEx(name, tree_node_flags | ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_Bullet | ImGuiTreeNodeFlags_NoTreePushOnOpen);
-            ImGui::TableNextColumn();
-            ImGui::TextColored(rgba_to_imvec(240, 0, 0, 255), "Unknown");
-            ImGui::TableNextColumn();
-            ImGui::Text("Unknown");
+            ImGui::SameLine(0.0f, 0.0f);
+            ImGui::PushID(static_cast<int>(j));
+            if (ImGui::Selectable(buf, step.object == target, 0, ImGui::CalcTextSize(buf))) {
+                m_retain_ptr = reinterpret_cast<const void*>(static_cast<std::uintptr_t>(snap.objects[step.object].ptr));
+                m_retain_dirty = true;
+            }
+            if (ImGui::IsItemHovered()) ImGui::SetTooltip("%s, %u bytes", lua_typename(L, snap.objects[step.object].type), snap.objects[step.object].size);
+            ImGui::PopID();
         }
+        ImGui::PopID();
+    }
+    ImGui::End();
+}
+
+void neko::luainspector::draw_profiler(lua_State*) {
+    luainspector_profiler& prof = m_profiler;
 
-    skip:
-        if (edited) {
+    if (ImGui::Button(prof.running() ? "Stop" : "Start")) {
+        if (prof.running()) {
+            prof.stop();
+            update_hook();
         } else {
-            lua_pop(L, 1);
+            prof.start();
+            if (!update_hook()) {
+                prof.stop();
+                print_line("profiler: another hook is installed on this state", LUACON_LOG_TYPE_ERROR);
+            }
         }
     }
-}
-
-int neko::luainspector::luainspector_init(lua_State* L) {
+    ImGui::SameLine();
+    if (ImGui::Button("Reset")) prof.reset();
+    ImGui::SameLine();
+    if (ImGui::Button("Save")) {
+        if (!prof.save_collapsed("luainspector.folded")) print_line("profiler: cannot write luainspector.folded", LUACON_LOG_TYPE_ERROR);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Copy")) {
+        std::string out;
+        prof.export_collapsed(out);
+        ImGui::SetClipboardText(out.c_str());
+    }
 
-    void* model_mem = lua_newuserdata(L, sizeof(neko::luainspector));
+    ImGui::SetNextItemWidth(120.0f);
+    if (ImGui::DragInt("Period", &prof.period, 10.0f, 100, 1000000, "%d instr")) {
+        prof.period = std::max(prof.period, 1);
+        if (prof.running()) update_hook();
+    }
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(120.0f);
+    ImGui::DragInt("Interval", &prof.interval_us, 10.0f, 0, 1000000, "%d us");
+    ImGui::SameLine();
+    ImGui::Checkbox("Flame graph", &m_profiler_flame);
+
+    const std::vector<luainspector_profiler::node>& nodes = prof.nodes();
+    ImGui::Text("%llu samples, %zu functions, %zu nodes", static_cast<unsigned long long>(prof.samples()), prof.function_count(), nodes.size());
+    if (prof.samples() == 0) return;
+
+    if (!ImGui::BeginChild("##profile", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar)) {
+        ImGui::EndChild();
+        return;
+    }
+    if (m_profiler_flame) {
+        std::uint32_t max_depth = 0;
+        for (const luainspector_profiler::node& n : nodes) max_depth = std::max(max_depth, n.depth);
+        const float row_height = ImGui::GetFrameHeight();
+        const float width = ImGui::GetContentRegionAvail().x;
+        const ImVec2 origin = ImGui::GetCursorScreenPos();
+        draw_profiler_flame(0, origin.x, width, origin.y, row_height, width / static_cast<double>(nodes[0].total));
+        ImGui::Dummy(ImVec2(width, row_height * (max_depth + 1)));
+    } else {
+        draw_profiler_tree(0);
+    }
+    ImGui::EndChild();
+}
 
-    neko::luainspector* inspector = new (model_mem) neko::luainspector();
+// Icicle layout, callers above callees, children placed left to right inside their parent's span
+void neko::luainspector::draw_profiler_flame(std::uint32_t n, float x, float width, float top, float row_height, double scale) {
+    const luainspector_profiler::node& node = m_profiler.nodes()[n];
+    const ImVec2 min(x, top + row_height * node.depth);
+    const ImVec2 max(x + width - 1.0f, min.y + row_height - 1.0f);
+    const float clip_top = ImGui::GetWindowPos().y;
+    const float clip_bottom = clip_top + ImGui::GetWindowHeight();
+    if (min.y > clip_bottom) return;  // and so are the callees below
+    if (max.y >= clip_top) {
+        const std::uint64_t h = neko_hash_str(reinterpret_cast<const char*>(&node.func), sizeof(node.func));
+        const ImU32 col = IM_COL32(200 + (h & 0x37), 90 + ((h >> 8) & 0x7f), 40 + ((h >> 16) & 0x3f), 255);
+        ImDrawList* draw = ImGui::GetWindowDrawList();
+        draw->AddRectFilled(min, max, col);
+        const std::string_view name = m_profiler.name(node.func);
+        if (width > 24.0f) ImGui::RenderTextClipped(ImVec2(min.x + 3.0f, min.y), max, name.data(), name.data() + name.size(), nullptr, ImVec2(0.0f, 0.5f));
+        if (ImGui::IsMouseHoveringRect(min, max) && ImGui::IsWindowHovered()) {
+            ImGui::SetTooltip("%.*s\ntotal %llu (%.1f%%), self %llu", static_cast<int>(name.size()), name.data(), static_cast<unsigned long long>(node.total),
+                              100.0 * node.total / m_profiler.samples(), static_cast<unsigned long long>(node.self));
+        }
+    }
 
-    inspector->setL(L);
-    inspector->m_history.resize(8);
+    float cx = x;
+    for (std::uint32_t c = node.first_child; c != luainspector_profiler::kNoNode; c = m_profiler.nodes()[c].next_sibling) {
+        const float w = static_cast<float>(m_profiler.nodes()[c].total * scale);
+        if (w >= 1.0f) draw_profiler_flame(c, cx, w, top, row_height, scale);
+        cx += w;
+    }
+}
 
-    return 1;
+// Top-down tree, children by total samples
+void neko::luainspector::draw_profiler_tree(std::uint32_t n) {
+    const std::vector<luainspector_profiler::node>& nodes = m_profiler.nodes();
+    const std::size_t begin = m_profiler_children.size();
+    for (std::uint32_t c = nodes[n].first_child; c != luainspector_profiler::kNoNode; c = nodes[c].next_sibling) m_profiler_children.push_back(c);
+    std::sort(m_profiler_children.begin() + begin, m_profiler_children.end(), [&nodes](std::uint32_t a, std::uint32_t b) { return nodes[a].total > nodes[b].total; });
+
+    const double samples = static_cast<double>(m_profiler.samples());
+    for (std::size_t i = begin; i < m_profiler_children.size(); ++i) {
+        const std::uint32_t c = m_profiler_children[i];
+        const luainspector_profiler::node& node = nodes[c];
+        const std::string_view name = m_profiler.name(node.func);
+        const ImGuiTreeNodeFlags flags = node.first_child == luainspector_profiler::kNoNode ? ImGuiTreeNodeFlags_Leaf : ImGuiTreeNodeFlags_None;
+        if (ImGui::TreeNodeEx(reinterpret_cast<void*>(static_cast<std::uintptr_t>(c)), flags, "%5.1f%% %5.1f%%  %.*s", 100.0 * node.total / samples, 100.0 * node.self / samples,
+                              static_cast<int>(name.size()), name.data())) {
+            draw_profiler_tree(c);
+            ImGui::TreePop();
+        }
+    }
+    m_profiler_children.resize(begin);
 }
 
-int neko::luainspector::luainspector_get(lua_State* L) {
-    neko::luainspector* inspector = neko::luainspector::get_from_registry(L);
-    lua_pushlightuserdata(L, inspector);
-    return 1;
+// Open every table of the snapshot up to max_depth levels below the root, the next refresh walks into them
+void neko::luainspector::expand_rows(int max_depth) {
+    for (std::size_t i = 1; i < m_snapshot.rows.size(); ++i) {
+        const inspect_table_row& row = m_snapshot.rows[i];
+        if (row.type == LUA_TTABLE && row.depth < max_depth) m_open_rows.insert(row.id);
+    }
+    m_snapshot.dirty = true;
 }
 
 int neko::luainspector::luainspector_draw(lua_State* L) {
     neko::luainspector* model = (neko::luainspector*)lua_touserdata(L, 1);
 
+    auto tab_flags = [model](const char* label) -> ImGuiTabItemFlags {
+        if (!model->m_select_tab || std::strcmp(model->m_select_tab, label) != 0) return ImGuiTabItemFlags_None;
+        model->m_select_tab = nullptr;
+        return ImGuiTabItemFlags_SetSelected;
+    };
+
+    model->m_memprof.sample_frame(L);
+    if (model->m_command) model->resume_command();
+    model->sample_watches(L);
+
     if (ImGui::Begin("Inspector")) {
 
         if (ImGui::BeginTabBar("lua_inspector", ImGuiTabBarFlags_None)) {
-            if (ImGui::BeginTabItem("Console")) {
+            if (ImGui::BeginTabItem("Console", nullptr, tab_flags("Console"))) {
                 bool textbox_react;
                 model->display(&textbox_react);
                 ImGui::EndTabItem();
             }
-            if (ImGui::BeginTabItem("Registry")) {
+            if (ImGui::BeginTabItem("Registry", nullptr, tab_flags("Registry"))) {
                 lua_pushglobaltable(L);  // _G
-                static char searchText[256] = "";
 
-                static inspect_table_config config;
-                config.search_str = searchText;
+                inspect_table_config& config = model->m_table_config;
+                config.search_str = model->m_search_text;
 
-                ImGui::InputTextWithHint("Search", "Search...", searchText, IM_ARRAYSIZE(searchText));
-
-                ImGui::Checkbox("Non-Function", &config.is_non_function);
+                if (ImGui::InputTextWithHint("Search", "Search...", model->m_search_text, IM_ARRAYSIZE(model->m_search_text))) {
+                    model->m_search_dirty = true;
+                    model->m_visible_dirty = true;
+                }
+                if (model->m_search_text[0] != '\0') {
+                    ImGui::SameLine();
+                    if (!model->m_search_index) {
+                        ImGui::TextDisabled("indexing... %u keys", model->m_index_pending ? static_cast<unsigned>(model->m_index_pending->entries.size()) : 0u);
+                    } else if (model->m_search_result.total > model->m_search_result.matches.size()) {
+                        ImGui::TextDisabled("%u matches, showing %u", static_cast<unsigned>(model->m_search_result.total), static_cast<unsigned>(model->m_search_result.matches.size()));
+                    } else {
+                        ImGui::TextDisabled("%u matches", static_cast<unsigned>(model->m_search_result.total));
+                    }
+                }
 
-                ImGui::Text("Registry contents:");
+                if (ImGui::Checkbox("Non-Function", &config.is_non_function)) model->m_visible_dirty = true;
+                ImGui::SameLine();
+                if (ImGui::Checkbox("Changed only", &config.changed_only)) model->m_visible_dirty = true;
+                ImGui::SameLine();
+                if (ImGui::Checkbox("Sequence summary", &config.sequence_summary)) model->m_snapshot.dirty = true;
+                ImGui::SameLine();
+                ImGui::Checkbox("Auto Refresh", &config.auto_refresh);
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(ImGui::CalcTextSize("A").x * 12.0f);
+                ImGui::DragFloat("Interval", &config.refresh_interval, 0.01f, 0.0f, 10.0f, "%.2f s");
+                ImGui::SameLine();
+                if (ImGui::Button("Refresh")) model->m_snapshot.dirty = true;
+
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(ImGui::CalcTextSize("A").x * 12.0f);
+                ImGui::DragInt("Budget", &config.walk_budget_us, 10.0f, 0, 100000, config.walk_budget_us > 0 ? "%d us" : "none");
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(ImGui::CalcTextSize("A").x * 8.0f);
+                if (ImGui::DragInt("Depth", &config.max_depth, 0.2f, 1, 256)) model->m_snapshot.dirty = true;
+
+                ImGui::Text("Registry contents: %u rows", static_cast<unsigned>(model->m_snapshot.rows.size()));
+                if (!model->m_edits.empty()) {
+                    ImGui::SameLine();
+                    ImGui::TextColored(rgba_to_imvec(220, 160, 40, 255), "%u edits pending", static_cast<unsigned>(model->m_edits.size()));
+                    ImGui::SameLine();
+                    if (ImGui::SmallButton("Apply now")) model->apply_edits(L);
+                    ImGui::SameLine();
+                    if (ImGui::SmallButton("Discard")) {
+                        model->m_edits.clear();
+                        __luainspector_push_scratch(L, __neko_lua_inspector_edits_lightkey());
+                        __luainspector_clear_slots(L, -1, static_cast<lua_Integer>(lua_rawlen(L, -1)));
+                        lua_pop(L, 1);
+                    }
+                }
+                if (model->m_walking) {
+                    // The previous snapshot size is the best guess of how far the walk has to go
+                    const std::size_t walked = model->m_pending.rows.size();
+                    const std::size_t expected = std::max(walked, model->m_snapshot.rows.size());
+                    char overlay[64];
+                    std::snprintf(overlay, sizeof(overlay), "walking %u / ~%u", static_cast<unsigned>(walked), static_cast<unsigned>(expected));
+                    ImGui::SameLine();
+                    ImGui::ProgressBar(expected ? static_cast<float>(walked) / expected : 0.f, ImVec2(-1.f, 0.f), overlay);
+                }
 
                 ImVec2 size = ImVec2(ImGui::GetContentRegionAvail().x, ImGui::GetWindowSize().y - 180);
                 if (ImGui::BeginChild("##lua_registry", size)) {
@@ -813,15 +4330,17 @@ int neko::luainspector::luainspector_draw(lua_State* L) {
 
                     const float TEXT_BASE_WIDTH = ImGui::CalcTextSize("A").x;
 
-                    static ImGuiTableFlags flags = ImGuiTableFlags_BordersV | ImGuiTableFlags_BordersOuterH | ImGuiTableFlags_Resizable | ImGuiTableFlags_RowBg | ImGuiTableFlags_NoBordersInBody;
+                    static ImGuiTableFlags flags = ImGuiTableFlags_BordersV | ImGuiTableFlags_BordersOuterH | ImGuiTableFlags_Resizable | ImGuiTableFlags_RowBg | ImGuiTableFlags_NoBordersInBody |
+                                                   ImGuiTableFlags_Sortable | ImGuiTableFlags_SortTristate;
 
-                    if (ImGui::BeginTable("lua_inspector_reg", 3, flags)) {
-                        ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_NoHide);
+                    if (ImGui::BeginTable("lua_inspector_reg", 4, flags)) {
+                        ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_NoHide | ImGuiTableColumnFlags_DefaultSort);
                         ImGui::TableSetupColumn("Type", ImGuiTableColumnFlags_WidthFixed, TEXT_BASE_WIDTH * 12.0f);
                         ImGui::TableSetupColumn("Value", ImGuiTableColumnFlags_WidthFixed, TEXT_BASE_WIDTH * 28.0f);
+                        ImGui::TableSetupColumn("Size", ImGuiTableColumnFlags_WidthFixed | ImGuiTableColumnFlags_PreferSortDescending, TEXT_BASE_WIDTH * 8.0f);
                         ImGui::TableHeadersRow();
 
-                        inspect_table(L, config);
+                        model->inspect_table(L, config);
 
                         ImGui::EndTable();
                     }
@@ -836,22 +4355,35 @@ int neko::luainspector::luainspector_draw(lua_State* L) {
                 ImGui::EndTabItem();
             }
 
-            if (ImGui::BeginTabItem("Info")) {
+            if (ImGui::BeginTabItem("Tables", nullptr, tab_flags("Tables"))) {
+                model->draw_tables(L);
+                ImGui::EndTabItem();
+            }
+
+            if (ImGui::BeginTabItem("Watch", nullptr, tab_flags("Watch"))) {
+                model->draw_watches(L);
+                ImGui::EndTabItem();
+            }
+
+            if (ImGui::BeginTabItem("Memory", nullptr, tab_flags("Memory"))) {
+                model->draw_memory(L);
+                ImGui::EndTabItem();
+            }
+
+            if (ImGui::BeginTabItem("Profiler", nullptr, tab_flags("Profiler"))) {
+                model->draw_profiler(L);
+                ImGui::EndTabItem();
+            }
+
+            if (ImGui::BeginTabItem("Info", nullptr, tab_flags("Info"))) {
                 lua_Integer kb = lua_gc(L, LUA_GCCOUNT, 0);
                 lua_Integer bytes = lua_gc(L, LUA_GCCOUNTB, 0);
 
-                // if (!arr.empty() && arr.back() != ((f64)bytes)) {
-                //     arr.push_back(((f64)bytes));
-                //     arr.erase(arr.begin());
-                // }
-
                 ImGui::Text("Lua MemoryUsage: %.2lf mb", ((double)kb / 1024.0f));
                 ImGui::Text("Lua Remaining: %.2lf mb", ((double)bytes / 1024.0f));
 
                 if (ImGui::Button("GC")) lua_gc(L, LUA_GCCOLLECT, 0);
 
-                // ImGui::PlotLines("Frame Times", arr.data(), arr.size(), 0, NULL, 0, 4000, ImVec2(0, 80.0f));
-
                 ImGui::EndTabItem();
             }
 
@@ -859,5 +4391,11 @@ int neko::luainspector::luainspector_draw(lua_State* L) {
         }
     }
     ImGui::End();
+
+    if (model->m_retain_open) model->draw_retainers(L);
+    if (model->m_viewer_open) model->draw_string_viewer(L);
+
+    // Nothing walks or draws from here on, the frame's edits land at once
+    if (model->auto_apply_edits) model->apply_edits(L);
     return 0;
 }
\ No newline at end of file
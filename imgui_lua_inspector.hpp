@@ -2,10 +2,17 @@
 #ifndef NEKO_LUA_INSPECTOR_HPP
 #define NEKO_LUA_INSPECTOR_HPP
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 // You should include your lua and imgui here
@@ -97,19 +104,74 @@ inline bool neko_lua_equal(lua_State* state, const Iterable& indices) {
     return true;
 }
 
+// FNV-1a, streamable: hashing "a.b" equals hashing ".b" seeded with the hash of "a"
+inline std::uint64_t neko_hash_str(const char* str, std::size_t len, std::uint64_t seed = 14695981039346656037ull) {
+    for (std::size_t i = 0; i < len; ++i) {
+        seed ^= static_cast<unsigned char>(str[i]);
+        seed *= 1099511628211ull;
+    }
+    return seed;
+}
+
 inline bool incomplete_chunk_error(const char* err, std::size_t len) { return err && (std::strlen(err) >= 5u) && (0 == std::strcmp(err + len - 5u, "<eof>")); }
 
+// Keys of a table and of its __index chain, cached by table pointer for autocomplete
+struct luainspector_completion_entry {
+    struct key {
+        std::uint32_t off;  // in text, nul terminated
+        std::uint32_t len;
+        float width;        // CalcTextSize at font_size, < 0 until first drawn
+    };
+    std::vector<char> text;
+    std::vector<key> keys;  // sorted, unique
+    float font_size = 0.f;
+    double time = -1.0;
+    std::uint32_t generation = 0;
+
+    std::string_view name(std::uint32_t i) const { return {&text[keys[i].off], keys[i].len}; }
+};
+
 struct luainspector_hints {
-    static std::string clean_table_list(const std::string& str);
+    static std::string_view clean_table_list(std::string_view str, std::string& out);
     static bool try_replace_with_metaindex(lua_State* L);
-    static bool collect_hints_recurse(lua_State* L, std::vector<std::string>& possible, const std::string& last, bool usehidden, unsigned left);
-    static void prepare_hints(lua_State* L, std::string str, std::string& last);
-    static bool collect_hints(lua_State* L, std::vector<std::string>& possible, const std::string& last, bool usehidden);
-    static std::string common_prefix(const std::vector<std::string>& possible);
+    static std::string_view prepare_hints(lua_State* L, std::string_view str, std::string& scratch);
+    static void collect_keys(lua_State* L, luainspector_completion_entry& entry);
+    static int fuzzy_score(std::string_view pattern, std::string_view str);
 };
 
 class luainspector;
 
+// Expression pinned in the Watch tab. Numeric results (booleans as 0 and 1) go to a ring of kHistory samples,
+// plotted as per-column min/max pairs so the whole ring draws in a few hundred points.
+struct luainspector_watch {
+    static constexpr std::size_t kHistory = 8192;
+    static constexpr int kPlotColumns = 512;
+
+    char expr[256]{};
+    char value[128]{};    // latest result as text, or the error
+    std::uint32_t slot{0};  // of the compiled function in the registry watch table
+    bool compiled{false};
+    bool error{false};
+    std::vector<float> samples;  // ring, allocated with the watch
+    std::size_t head{0};         // next write
+    std::size_t count{0};
+
+    void push(float v);
+    void clear() { head = count = 0; }
+    float at(std::size_t i) const { return samples[(head + kHistory - count + i) % kHistory]; }  // oldest first
+    int downsample(float* out, int columns, float& lo, float& hi) const;
+};
+
+// What a console command cost. Only its own slices are counted, not the frames it waited in between.
+struct luainspector_command_stats {
+    double us = 0.0;                 // time spent running
+    std::uint64_t instructions = 0;  // VM instructions, to within one hook period
+    std::uint64_t allocated = 0;     // bytes, through the memory profiler's allocator
+    std::uint64_t freed = 0;
+    std::uint32_t gc_cycles = 0;  // collections that completed
+    std::uint32_t slices = 0;     // frames it ran in
+};
+
 struct command_line_input_callback_UserData {
     std::string* Str;
     ImGuiInputTextCallback ChainCallback;
@@ -120,24 +182,624 @@ struct command_line_input_callback_UserData {
 struct inspect_table_config {
     const char* search_str = 0;
     bool is_non_function = false;
+    bool auto_refresh = true;
+    float refresh_interval = 0.25f;  // seconds between snapshot refreshes
+    int walk_budget_us = 1000;       // time a refresh may spend per frame, 0 walks everything at once
+    float search_index_interval = 5.0f;  // seconds before the search index is rebuilt while searching
+    int search_max_results = 1000;
+    bool changed_only = false;  // only rows that changed recently and their ancestors
+    bool sequence_summary = false;  // min/max/mean row for long numeric sequences, reads every element on refresh
+    int max_depth = 32;             // open tables deeper than this are not walked
+};
+
+// One entry of the Registry snapshot. Children of a walked table are contiguous, so a node is its key plus a child range
+struct inspect_table_row {
+    std::uint64_t id;            // hash of the dotted path, keys the open state across refreshes
+    const void* table;           // source table the key lives in
+    std::uint32_t name_off;      // key text in inspect_table_snapshot::text (nul terminated)
+    std::uint32_t name_len;
+    std::uint32_t preview_off;   // the start of a string's first line is copied for display
+    std::uint32_t preview_len;
+    std::uint32_t child_begin;   // children in inspect_table_snapshot::rows, valid when child_slot != 0
+    std::uint32_t child_count;
+    std::int32_t table_slot;     // anchor slot of the owning table
+    std::int32_t child_slot;     // anchor slot of this table if it was walked, 0 otherwise
+    std::uint64_t fingerprint;   // hash of a scalar value, identity of a reference, id of the sequence for a page
+    std::uint64_t content;       // of a walked table, order-independent hash of its children, 0 until walked
+    double changed;              // ImGui::GetTime() of the last change seen, for a walked table including its content
+    std::uint16_t depth;
+    std::uint8_t type;           // lua type of the value, or luainspector::kRowPage / kRowSummary
+    std::uint8_t stable;         // walks in a row that found a table's content unchanged
+    bool long_string;            // the preview is only the start of the string
+    bool binary_string;          // no preview, shown in hex
+    bool back_ref;               // an open table already walked under another path, not walked again
+    bool too_deep;               // an open table below inspect_table_config::max_depth, not walked
+    std::uint8_t key_type;       // lua type of the key, the name is only its text
+    bool key_integer;            // a number key that is an integer
+    union {
+        lua_Integer integer;     // integer, boolean or light userdata key
+        double number;           // float key
+        std::int32_t slot;       // anchor slot of a reference key, only while the row is open since only editors need it
+    } key;
+    union {
+        double number;
+        bool boolean;
+        const void* pointer;
+        std::uint64_t length;  // of a string
+        struct {
+            lua_Integer first, last;  // element range of a page
+        } page;
+        std::uint32_t summary;  // in inspect_table_snapshot::summaries
+    };
+};
+
+// Summary of the elements 1..#t of a long sequence, when they are all numbers
+struct inspect_sequence_summary {
+    double min, max, sum;
+    lua_Integer count;  // #t when the pages were made
+    lua_Integer nan;
+    bool numeric;
+};
+
+// Inspector-owned copy of the expanded part of the Lua tree. Views read from here and the Lua heap is
+// only touched when it is refreshed, every inspect_table_config::refresh_interval or on demand.
+struct inspect_table_snapshot {
+    std::vector<inspect_table_row> rows;  // rows[0] is the root table
+    std::vector<char> text;               // key names and string previews
+    std::vector<inspect_sequence_summary> summaries;
+    double time = -1.0;                   // ImGui::GetTime() of the last refresh
+    std::uint32_t generation = 0;         // bumped on every refresh
+    bool dirty = true;                    // refresh on the next frame regardless of the interval
+
+    const char* name(const inspect_table_row& row) const { return &text[row.name_off]; }
+};
+
+// A write to a Registry row made in an editor, kept until luainspector::apply_edits(). The table and an object
+// key wait in a registry table, so the write lands where the row was read from whatever the next walks do.
+struct luainspector_edit {
+    std::uint64_t row;          // id of the edited row, a second edit of the same row replaces the first
+    std::int32_t table_slot;    // in the edits anchor
+    std::uint8_t key_type;      // as in inspect_table_row, an object key is in key.slot of the edits anchor
+    bool key_integer;
+    decltype(inspect_table_row::key) key;
+    std::string key_text;       // of a string key
+    std::uint8_t value_type;    // LUA_TSTRING or LUA_TNUMBER
+    double number;
+    std::string text;
+};
+
+// Every key reachable from the root (each table walked once) with its parent, so full dotted paths can be
+// rebuilt, and a trigram posting list over the key text. Immutable once built, queries run off the draw path.
+struct luainspector_search_index {
+    struct entry {
+        std::uint64_t id;       // path hash, same as inspect_table_row::id
+        std::uint32_t parent;   // entry of the owning table, kNoParent for keys of the root
+        std::uint32_t key_off;  // in keys
+        std::uint32_t key_len;
+        std::uint8_t type;
+    };
+    // Size of one walked table, the walk visits every entry anyway
+    struct table_stats {
+        std::uint32_t entry;  // the table's own entry, kNoParent for the root
+        std::uint32_t border;  // lua_rawlen when the walk reached it
+        std::uint32_t array;   // integer keys in [1, border]
+        std::uint32_t hash;    // all other keys
+        std::uint64_t bytes;   // estimated from the two parts, filled once the walk completes
+    };
+    static constexpr std::uint32_t kNoParent = 0xffffffffu;
+
+    std::vector<entry> entries;
+    std::vector<char> keys;
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> trigrams;  // ascending entry indices
+    std::vector<table_stats> tables;
+
+    void clear();
+    void add_entry(std::uint64_t id, std::uint32_t parent, const char* key, std::size_t len, int type);
+    std::size_t path(std::uint32_t index, char* buf, std::size_t size) const;
+    void query(std::string_view q, std::size_t max_results, std::vector<std::uint32_t>& out, std::size_t& total) const;
+};
+
+struct luainspector_search_result {
+    std::shared_ptr<const luainspector_search_index> index;
+    std::vector<std::uint32_t> matches;  // entry indices, at most inspect_table_config::search_max_results
+    std::size_t total = 0;
 };
 
 enum luainspector_logtype { LUACON_LOG_TYPE_WARNING = 1, LUACON_LOG_TYPE_ERROR = 2, LUACON_LOG_TYPE_NOTE = 4, LUACON_LOG_TYPE_SUCCESS = 0, LUACON_LOG_TYPE_MESSAGE = 3 };
 
+// Console history with a fixed byte budget. Text is written into a ring of fixed-size chunks and entries keep
+// only offsets and type in a ring of their own; moving on to the next chunk evicts the entries that pointed
+// into it, one O(1) pop each. Nothing is allocated per message once reserve() has run.
+class luainspector_log {
+public:
+    struct entry {
+        std::uint32_t off;  // in the arena
+        std::uint32_t len;
+        std::uint8_t type;  // luainspector_logtype
+    };
+
+    static constexpr std::size_t kChunkSize = 64 * 1024;  // also the longest message kept
+    static constexpr std::size_t kDefaultBytes = 4 * 1024 * 1024;
+    static constexpr std::size_t kDefaultEntries = 64 * 1024;
+
+    void reserve(std::size_t byte_budget, std::size_t max_entries);
+    void push(std::string_view msg, luainspector_logtype type);
+
+    std::size_t size() const { return m_count; }
+    std::size_t capacity() const { return m_entries.size(); }
+    const entry& operator[](std::size_t i) const { return m_entries[(m_head + i) % m_entries.size()]; }  // 0 is the oldest
+    std::string_view text(const entry& e) const { return {m_text.data() + e.off, e.len}; }
+    std::uint64_t evicted() const { return m_evicted; }  // entries dropped so far, entry i is number evicted() + i overall
+
+private:
+    void pop_front() {
+        m_head = (m_head + 1) % m_entries.size();
+        --m_count;
+        ++m_evicted;
+    }
+
+    std::vector<char> m_text;
+    std::vector<entry> m_entries;
+    std::size_t m_chunk_count = 0;
+    std::size_t m_chunk = 0;  // chunk being written
+    std::size_t m_pos = 0;    // write position in it
+    std::size_t m_head = 0;
+    std::size_t m_count = 0;
+    std::uint64_t m_evicted = 0;
+};
+
+// Optional lua_Alloc wrapper around a state's allocator. Counts and bytes are kept per power-of-two size class;
+// the allocator cannot ask Lua where it is called from, so bytes pile up until the count hook next fires and are
+// charged to the line running then. Allocations made inside coroutines are charged at the next hook on the
+// main thread. Heap size and allocations per frame go into fixed rings for plotting.
+class luainspector_memprof {
+public:
+    struct site {
+        std::uint64_t id;  // hash of source and line
+        char source[LUA_IDSIZE];
+        int line;
+        std::uint64_t count;
+        std::uint64_t bytes;
+    };
+
+    static constexpr int kSizeClasses = 32;         // class i holds sizes in (2^(i-1), 2^i]
+    static constexpr int kHistory = 512;             // frames kept in the plots
+    static constexpr int kHookCount = 1000;          // instructions between attribution samples
+    static constexpr std::size_t kMaxSites = 4096;  // past this everything goes to the last site
+
+    bool install(lua_State* L, bool counters_only = false);  // counters_only meters allocated_bytes()/freed_bytes() alone
+    void uninstall();
+    bool installed() const { return m_L != nullptr; }
+    void reset();
+    void sample_frame(lua_State* L);  // once per frame, installed or not
+
+    std::uint64_t live() const { return m_live; }
+    std::uint64_t peak() const { return m_peak; }
+    std::uint64_t allocs() const { return m_allocs; }
+    std::uint64_t frees() const { return m_frees; }
+    std::uint64_t reallocs() const { return m_reallocs; }
+    std::uint64_t allocated_bytes() const { return m_allocated_bytes; }  // since construction, reset() leaves these
+    std::uint64_t freed_bytes() const { return m_freed_bytes; }
+    std::uint64_t class_count(int i) const { return m_class_count[i]; }
+    std::uint64_t class_bytes(int i) const { return m_class_bytes[i]; }
+    const std::vector<site>& sites() const { return m_sites; }
+    const float* heap_history() const { return m_heap_kb; }
+    const float* alloc_history() const { return m_frame_allocs; }
+    int history_head() const { return m_history_head; }  // oldest sample, the values_offset for ImGui::PlotLines
+
+    static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+    void on_count_hook(lua_State* L, lua_Debug* ar);
+
+private:
+    void charge(const char* source, int line);
+
+    lua_State* m_L{nullptr};
+    bool m_counters_only{false};  // installed to meter a console command, the stats the Memory tab shows are left alone
+    lua_Alloc m_alloc{nullptr};  // the wrapped allocator
+    void* m_ud{nullptr};
+
+    std::uint64_t m_live{0};
+    std::uint64_t m_peak{0};
+    std::uint64_t m_allocs{0};
+    std::uint64_t m_frees{0};
+    std::uint64_t m_reallocs{0};
+    std::uint64_t m_allocated_bytes{0};
+    std::uint64_t m_freed_bytes{0};
+    std::uint64_t m_class_count[kSizeClasses]{};
+    std::uint64_t m_class_bytes[kSizeClasses]{};
+    std::uint64_t m_pending_count{0};  // not charged to a site yet
+    std::uint64_t m_pending_bytes{0};
+
+    std::vector<site> m_sites;
+    std::unordered_map<std::uint64_t, std::uint32_t> m_site_index;
+
+    float m_heap_kb[kHistory]{};
+    float m_frame_allocs[kHistory]{};
+    int m_history_head{0};
+    std::uint64_t m_frame_mark{0};  // m_allocs at the previous sample
+};
+
+// Sampling CPU profiler fed by the count hook. A sample walks the stack of the running thread and counts
+// one for every node on its path through a call tree; functions are interned once, by C function pointer
+// or by source and first line, and nodes refer to them by index. Sampling is gated by both an instruction
+// period and a minimum interval so the overhead stays bounded while it runs.
+class luainspector_profiler {
+public:
+    struct function {
+        std::uint32_t name_off;  // "name (source:line)" in text
+        std::uint32_t name_len;
+    };
+    struct node {
+        std::uint32_t func;  // kNoFunc for the root
+        std::uint32_t parent;
+        std::uint32_t first_child;
+        std::uint32_t next_sibling;
+        std::uint32_t depth;
+        std::uint64_t self;   // samples with this node on top
+        std::uint64_t total;  // samples through this node
+    };
+
+    static constexpr std::uint32_t kNoFunc = 0xffffffffu;
+    static constexpr std::uint32_t kNoNode = 0xffffffffu;
+    static constexpr int kMaxDepth = 128;               // innermost frames kept of deeper stacks
+    static constexpr std::size_t kMaxNodes = 1u << 18;  // when full, samples stop at the deepest existing node
+
+    int period = 1000;       // instructions between hook calls
+    int interval_us = 1000;  // minimum time between samples
+
+    void start();
+    void stop() { m_running = false; }
+    bool running() const { return m_running; }
+    void reset();
+    void sample(lua_State* L);
+    void on_count_hook(lua_State* L);
+
+    const std::vector<node>& nodes() const { return m_nodes; }
+    std::string_view name(std::uint32_t func) const {
+        if (func == kNoFunc) return "root";
+        return {m_text.data() + m_functions[func].name_off, m_functions[func].name_len};
+    }
+    std::size_t function_count() const { return m_functions.size(); }
+    std::uint64_t samples() const { return m_nodes.empty() ? 0 : m_nodes[0].total; }
+
+    void export_collapsed(std::string& out) const;  // one "a;b;c count" line per stack, as flamegraph.pl reads
+    bool save_collapsed(const char* path) const;
+
+private:
+    std::uint32_t intern(lua_State* L, lua_Debug* ar);
+    std::uint32_t child(std::uint32_t parent, std::uint32_t func);
+
+    bool m_running{false};
+    double m_last_sample{0.0};
+    std::vector<node> m_nodes;
+    std::vector<function> m_functions;
+    std::vector<char> m_text;
+    std::unordered_map<std::uint64_t, std::uint32_t> m_function_index;  // identity hash -> function
+    std::unordered_map<std::uint64_t, std::uint32_t> m_child_index;     // parent << 32 | func -> node
+};
+
+// Open addressing map from object identities to indices. Linear probing with backward shift on erase, key 0 is
+// the empty slot, which is fine for pointers. 16 bytes a slot at no more than half load.
+class luainspector_ptr_map {
+public:
+    static constexpr std::uint32_t kNone = 0xffffffffu;
+
+    void clear() {  // keeps the slots, refilling to the same size does not allocate
+        std::fill(m_slots.begin(), m_slots.end(), slot{0, 0});
+        m_size = 0;
+    }
+    void reserve(std::size_t n);
+    std::uint32_t find(std::uint64_t key) const;
+    std::uint32_t insert(std::uint64_t key, std::uint32_t value);  // the value already there, or kNone if inserted
+    bool erase(std::uint64_t key);
+    std::size_t size() const { return m_size; }
+
+private:
+    struct slot {
+        std::uint64_t key;
+        std::uint32_t value;
+    };
+    static std::size_t mix(std::uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        return static_cast<std::size_t>(key);
+    }
+
+    std::vector<slot> m_slots;
+    std::size_t m_size{0};
+};
+
+// Everything reachable from the registry at one point in time: tables, functions and their upvalues, userdata
+// with metatables and user values, threads with their frames and locals, and strings as leaves. Objects are
+// numbered in breadth-first order, so the parent chain of an object is a shortest path from the registry, and
+// the outgoing edges of object i are edges[objects[i].edge_begin, edge_end(i)).
+class luainspector_heap_snapshot {
+public:
+    struct object {
+        std::uint64_t ptr;         // lua_topointer, or the characters of a string
+        std::uint32_t size;        // estimated bytes
+        std::uint32_t parent;      // first seen from, kNoObject for the registry
+        std::uint32_t label;       // key it was first seen under: an offset in labels, or kIndexLabel | n
+        std::uint32_t edge_begin;  // in edges
+        std::uint8_t type;
+        std::uint8_t flags;  // kWeakKeys | kWeakValues
+    };
+
+    static constexpr std::uint32_t kNoObject = 0xffffffffu;
+    static constexpr std::uint32_t kIndexLabel = 0x80000000u;
+    static constexpr std::uint32_t kWeakEdge = 0x40000000u;  // on edge labels, the edge does not keep its target alive
+    static constexpr std::uint32_t kLabelMask = 0x3fffffffu;
+    static constexpr std::uint8_t kWeakKeys = 1;
+    static constexpr std::uint8_t kWeakValues = 2;
+
+    std::vector<object> objects;
+    std::vector<std::uint32_t> edges;
+    std::vector<std::uint32_t> edge_labels;  // parallel to edges
+    std::vector<char> labels;                // nul terminated
+    std::vector<std::uint32_t> by_ptr;  // object indices ordered by ptr
+    std::uint64_t total_size{0};
+    double time{0.0};
+
+    // Walks the heap of L's state without recursion; the Lua stack use is constant and the queue of pending
+    // objects lives in a Lua table
+    bool capture(lua_State* L);
+    void clear();
+
+    std::uint32_t edge_end(std::uint32_t i) const { return i + 1 < objects.size() ? objects[i + 1].edge_begin : static_cast<std::uint32_t>(edges.size()); }
+    std::uint32_t find(std::uint64_t ptr) const;
+    // Dotted path from the registry (truncated to size - 1, nul terminated), generic folds array indices into []
+    std::size_t path(std::uint32_t i, char* buf, std::size_t size, bool generic = false) const;
+    // Text of a label on an edge leaving object from, returns its length
+    std::size_t format_label(std::uint32_t from, std::uint32_t label, char* buf, std::size_t size, bool generic = false) const;
+
+    bool save(const char* file) const;
+    bool load(const char* file);
+
+private:
+    std::uint32_t intern_label(const char* text, std::size_t len);
+    luainspector_ptr_map m_label_index;  // hash of text -> offset, only while capturing
+};
+
+// What changed between two heap snapshots, grouped by type and generic creating path. Objects are matched
+// by identity, so an address reused by an object of the same type shows up as grown or shrunk, not new.
+struct luainspector_heap_diff {
+    struct group {
+        std::uint32_t path_off;  // in text
+        std::uint32_t path_len;
+        std::uint8_t type;
+        std::int64_t new_count, new_bytes;
+        std::int64_t freed_count, freed_bytes;
+        std::int64_t grown_count, grown_bytes;  // same object, size changed
+    };
+
+    std::vector<group> groups;  // largest net growth first
+    std::vector<char> text;
+
+    void compute(const luainspector_heap_snapshot& before, const luainspector_heap_snapshot& after);
+    std::string_view path(const group& g) const { return {text.data() + g.path_off, g.path_len}; }
+};
+
+// Reverse edges of a heap snapshot, answering "who keeps this alive?". The referrers of object i are
+// referrers[ref_begin[i], ref_begin[i + 1]); weak edges are left out since they retain nothing.
+class luainspector_retention_index {
+public:
+    struct step {
+        std::uint32_t object;
+        std::uint32_t label;  // of the edge from the previous step into this object
+    };
+
+    luainspector_heap_snapshot snapshot;
+    std::vector<std::uint32_t> ref_begin;
+    std::vector<std::uint32_t> referrers;
+    std::vector<std::uint32_t> ref_labels;  // parallel to referrers
+
+    bool build(lua_State* L);
+    bool empty() const { return snapshot.objects.empty(); }
+    std::uint32_t find(const void* ptr) const { return m_index.find(reinterpret_cast<std::uintptr_t>(ptr)); }
+    bool is_root(std::uint32_t i) const { return i == 0 || i == m_globals || snapshot.objects[i].type == LUA_TTHREAD; }
+
+    // The shortest path from a root (registry, _G or a thread stack) through each of up to max_paths direct
+    // referrers of target. Path k is steps[path_begin[k], path_begin[k + 1]), root first and target last.
+    void retainers(std::uint32_t target, std::size_t max_paths, std::vector<step>& steps, std::vector<std::uint32_t>& path_begin);
+
+private:
+    luainspector_ptr_map m_index;  // object identity -> index
+    std::uint32_t m_globals{luainspector_heap_snapshot::kNoObject};
+    std::vector<std::uint32_t> m_stamp;  // == m_epoch when visited by the current search
+    std::vector<std::uint32_t> m_next;   // one step closer to the target
+    std::vector<std::uint32_t> m_next_label;
+    std::vector<std::uint32_t> m_queue;
+    std::uint32_t m_epoch{0};
+};
+
 class luainspector {
 private:
-    std::vector<std::pair<std::string, luainspector_logtype>> messageLog;
+    luainspector_log m_log;
+    std::vector<double> m_log_offsets;  // y of each entry relative to the first ever measured, indexed like the log ring
+    double m_log_end{0.0};              // y below the last measured entry
+    std::uint64_t m_log_measured{0};    // overall number of the first entry without an offset
+    float m_log_wrap_width{-1.f};
+    float m_log_font_size{0.f};
 
-    lua_State* L;
+    lua_State* L{nullptr};
     std::vector<std::string> m_history;
     int m_hindex;
 
-    std::string cmd, cmd2;
+    std::string cmd;
     bool m_should_take_focus{false};
     ImGuiID m_input_text_id{0u};
     ImGuiID m_previously_active_id{0u};
     std::string_view m_autocomlete_separator{" | "};
-    std::vector<std::string> m_current_autocomplete_strings{};
+    std::unordered_map<const void*, luainspector_completion_entry> m_completion_cache;
+    luainspector_completion_entry* m_completion_entry{nullptr};
+    std::vector<std::uint32_t> m_completion_ranked;  // keys of m_completion_entry, best match first
+    std::vector<std::pair<int, std::uint32_t>> m_completion_scored;
+    std::uint32_t m_completion_generation{1};        // bumped by every command, which may have changed any table
+
+    // Kept across frames and keystrokes so the console does not allocate once they have grown
+    std::string m_hint_buffer;      // cleaned table path of the input, see luainspector_hints::prepare_hints()
+    std::string m_complete_buffer;  // input after a completion
+    std::string m_line_buffer;      // console line being assembled
+    std::vector<char> m_ellipsis_buffer;
+
+    // Compiled console chunks, most recently used first out of kChunkCacheSize. Entry i holds the source,
+    // the function is in slot i + 1 of a registry table.
+    struct chunk_entry {
+        std::uint64_t hash;
+        std::uint64_t used;  // m_chunk_tick at the last hit
+        std::string source;
+    };
+    std::vector<chunk_entry> m_chunk_cache;
+    std::uint64_t m_chunk_tick{0};
+    static constexpr std::size_t kChunkCacheSize = 64;
+
+    std::vector<luainspector_watch> m_watches;
+    char m_watch_input[256]{};
+    float m_watch_rate{30.0f};  // samples per second
+    double m_watch_next{0.0};   // time of the next sample
+    std::uint32_t m_watch_slot{0};
+    float m_watch_plot[2 * luainspector_watch::kPlotColumns];
+
+    // Console command running as a coroutine, resumed once per frame until it ends or is cancelled
+    lua_State* m_command{nullptr};  // anchored in the registry while it runs
+    double m_command_started{0.0};
+    std::chrono::steady_clock::time_point m_command_deadline;  // the hook yields past it
+    bool m_command_hook_yield{false};
+    bool m_command_resuming{false};
+    bool m_command_owns_memprof{false};  // installed for the command only, to meter its allocations
+    std::uint32_t m_command_serial{0};   // tells the GC sentinels of an old command apart
+    luainspector_command_stats m_command_stats;
+    std::chrono::steady_clock::time_point m_command_slice_start;
+    std::uint64_t m_command_allocated_mark{0};  // memory profiler totals when the slice started
+    std::uint64_t m_command_freed_mark{0};
+    static constexpr int kCommandHookCount = 1000;  // instructions between two looks at the deadline
+
+    static constexpr double kCompletionTTL = 2.0;  // seconds a cached key list is trusted
+    static constexpr std::size_t kCompletionCacheSize = 64;
+
+    inspect_table_config m_table_config;
+    char m_search_text[256]{};
+    inspect_table_snapshot m_snapshot;
+    inspect_table_snapshot m_pending;  // being walked, swapped in once complete
+    std::uint32_t m_walk_row{0};       // row whose table the cursor is in
+    std::uint32_t m_walk_marked_row{UINT32_MAX};  // row the sizes below were taken for, before it was reused or walked
+    std::uint32_t m_walk_rows_begin{0};
+    std::uint32_t m_walk_text_begin{0};
+    int m_walk_retries{0};
+    bool m_walk_started{false};
+    bool m_walking{false};
+    bool m_walk_full{true};           // rewalk tables whose content has been stable too
+    double m_walk_now{0.0};           // change time given to rows of this walk
+    std::uint64_t m_walk_content{0};  // content hash of the table being walked so far
+    bool m_walk_parent_known{false};  // the table being walked was walked last time, its new keys are changes
+    lua_Integer m_walk_border{0};     // #t of the table being walked when its sequence is paged, 0 otherwise
+    lua_Integer m_walk_index{0};      // next element of the page or summary being walked
+    std::vector<double> m_summary_buffer;
+    luainspector_ptr_map m_row_index;  // row id -> index in m_snapshot.rows, built when a walk starts
+    luainspector_ptr_map m_walk_tables;  // table -> the m_pending row that walks it, each table is walked once
+    std::vector<std::uintptr_t> m_walk_tables_added;  // inserted into m_walk_tables for m_walk_marked_row
+    lua_Integer m_walk_anchor_begin{0};
+    std::uint32_t m_walk_summaries_begin{0};
+    std::vector<std::uint8_t> m_row_hot;  // changed recently or has such a descendant, for the changed only filter
+    std::vector<std::uint32_t> m_visible_rows;  // indices into m_snapshot.rows, kRowEditor marks the editor line of an open row
+    std::vector<std::uint32_t> m_visible_stack;
+
+    // Sorted child order of each open table, by path id. Sorting is redone only when the set of keys changes (the
+    // values too when sorting by value or size). If only the lua_next order changed, e.g. after a rehash, the
+    // sorted ids are mapped back to their new positions instead.
+    struct sort_order {
+        std::uint64_t members;             // hash of the child ids, and values when they decide the order
+        std::uint64_t layout;              // order dependent hash of the child ids
+        std::uint32_t used;                // m_sort_stamp of the last build that needed it
+        std::vector<std::uint64_t> ids;    // children by the sort
+        std::vector<std::uint32_t> order;  // the same as offsets from child_begin
+    };
+    struct sort_key {
+        std::uint32_t offset;  // from child_begin
+        std::uint8_t rank;     // summary, pages, then keys
+        bool numeric_name;     // integer and float keys sort by value, before string keys
+        double name_number;
+        double value;          // number, boolean, or size, depending on the column
+        const char* string;    // bytes of a string value for the Value column
+        std::size_t string_len;
+    };
+    std::unordered_map<std::uint64_t, sort_order> m_sort_orders;
+    std::vector<sort_key> m_sort_keys;
+    luainspector_ptr_map m_sort_positions;  // child id -> offset, while remapping
+    std::uint32_t m_sort_stamp{0};
+    int m_sort_column{-1};  // -1 keeps lua_next order
+    bool m_sort_ascending{true};
+    std::unordered_set<std::uint64_t> m_open_rows;
+    bool m_visible_dirty{true};
+
+    std::shared_ptr<const luainspector_search_index> m_search_index;
+    std::shared_ptr<luainspector_search_index> m_index_pending;  // being walked
+    std::shared_ptr<luainspector_search_index> m_index_spare;    // the index before m_search_index, refilled by the next walk
+    std::vector<std::uint32_t> m_index_queue;                     // owning entry of each queued table
+    luainspector_ptr_map m_index_visited;
+    std::size_t m_index_head{0};
+    bool m_index_started{false};
+    double m_index_time{-1.0};
+    std::future<luainspector_search_result> m_search_future;
+    luainspector_search_result m_search_result;
+    std::unordered_set<std::uint64_t> m_search_matches;   // path ids of the matches
+    std::unordered_set<std::uint64_t> m_search_expanded;  // path ids of their ancestors, walked and drawn open
+    bool m_search_dirty{false};
+
+    std::vector<std::uint32_t> m_table_order;  // into m_search_index->tables, by the current sort
+    const luainspector_search_index* m_table_order_index{nullptr};
+    std::uint64_t m_scroll_to_row{0};  // row id the Registry view should bring into sight
+    double m_scroll_deadline{0.0};
+
+    const char* m_select_tab{nullptr};
+
+    std::uint64_t m_edit_row{0};  // string row being edited, m_edit_buffer only holds memory meanwhile
+    std::string m_edit_buffer;
+    std::vector<luainspector_edit> m_edits;  // in the order they were made
+    const char* m_viewer_str{nullptr};  // pinned in the registry while the viewer is open
+    std::size_t m_viewer_len{0};
+    std::vector<std::uint32_t> m_viewer_lines;  // start of every display line in text mode
+    char m_viewer_title[128]{};
+    bool m_viewer_hex{false};
+    bool m_viewer_open{false};
+
+    static constexpr std::size_t kStringPreview = 48;      // bytes of a string shown in its row
+    static constexpr std::size_t kViewerLine = 256;        // text mode wraps longer lines
+    static constexpr std::size_t kMaxEditBytes = 1 << 20;  // bigger strings are only viewed
+    static constexpr std::size_t kHashedString = 4096;     // longer strings are fingerprinted by their length and ends
+
+    luainspector_memprof m_memprof;
+    std::vector<std::uint32_t> m_memprof_order;  // site indices, heaviest first
+
+    std::vector<std::unique_ptr<luainspector_heap_snapshot>> m_heap_snapshots;
+    luainspector_heap_diff m_heap_diff;
+    int m_heap_before{0};
+    int m_heap_after{0};
+
+    luainspector_retention_index m_retention;
+    std::vector<luainspector_retention_index::step> m_retain_steps;
+    std::vector<std::uint32_t> m_retain_paths;
+    const void* m_retain_ptr{nullptr};  // object whose retainers are shown
+    bool m_retain_dirty{false};
+    bool m_retain_open{false};
+
+    luainspector_profiler m_profiler;
+    std::vector<std::uint32_t> m_profiler_children;  // scratch stack for the tree view
+    bool m_profiler_flame{true};
+
+    static constexpr double kChangeFade = 1.5;    // seconds a change stays highlighted
+    static constexpr double kChurnWindow = 5.0;   // seconds a change keeps a row in the changed only view
+    static constexpr double kNeverChanged = -1.0e9;
+
+    // Tables longer than a page show their sequence as pages of elements fetched with lua_rawgeti when opened
+    static constexpr lua_Integer kPageSize = 1000;
+    static constexpr lua_Integer kSummaryChunk = 1024;  // elements copied out per summary pass
+    static constexpr std::uint8_t kRowPage = 0xf0;     // row type of a page of a sequence
+    static constexpr std::uint8_t kRowSummary = 0xf1;  // row type of the summary of a sequence
+
+    static constexpr std::uint32_t kRowEditor = 0x80000000u;
+    static constexpr std::uint32_t kRowInMatch = 0x40000000u;
 
 private:
     static int try_push_style(ImGuiCol col, const std::optional<ImVec4>& color) {
@@ -149,11 +811,33 @@ private:
     }
 
 public:
+    int command_budget_us = 2000;  // longest a console command may run in one frame
+    bool auto_apply_edits = true;  // apply Registry edits at the end of luainspector_draw, else the host calls apply_edits()
+
     void display(bool* textbox_react) noexcept;
-    void print_line(const std::string& msg, luainspector_logtype type) noexcept;
+    void print_line(std::string_view msg, luainspector_logtype type) noexcept;
+    void set_log_budget(std::size_t bytes, std::size_t entries) { m_log.reserve(bytes, entries); }
 
     static luainspector* get_from_registry(lua_State* L);
-    static void inspect_table(lua_State* L, inspect_table_config& cfg);
+    void inspect_table(lua_State* L, inspect_table_config& cfg);
+    void refresh_snapshot(lua_State* L);
+    bool walk_snapshot(lua_State* L, int budget_us);
+    bool walk_snapshot_slice(lua_State* L, int budget_us);
+    bool walk_search_index(lua_State* L, int budget_us);
+    bool walk_search_index_slice(lua_State* L, int budget_us);
+    const inspect_table_snapshot& snapshot() const { return m_snapshot; }
+    bool walking() const { return m_walking; }
+    void expand_rows(int max_depth);
+    void set_sort(int column, bool ascending) {  // Registry column to sort by, -1 keeps lua_next order
+        m_sort_column = column;
+        m_sort_ascending = ascending;
+    }
+    const std::vector<std::uint32_t>& sorted_children(std::uint32_t parent);
+    luainspector_memprof& memprof() { return m_memprof; }
+    luainspector_profiler& profiler() { return m_profiler; }
+    bool update_hook();
+    static void hook(lua_State* L, lua_Debug* ar);
+    void select_tab(const char* label) { m_select_tab = label; }  // label must outlive the next draw
     static int luainspector_init(lua_State* L);
     static int luainspector_draw(lua_State* L);
     static int luainspector_get(lua_State* L);
@@ -163,10 +847,59 @@ public:
     int command_line_input_callback(ImGuiInputTextCallbackData* data);
     bool command_line_input(const char* label, std::string* str, ImGuiInputTextFlags flags = 0, ImGuiInputTextCallback callback = nullptr, void* user_data = nullptr);
     void show_autocomplete() noexcept;
-    std::string read_history(int change);
-    std::string try_complete(std::string inputbuffer);
+    void measure_log(float wrap_width);
+    const std::string& read_history(int change);
+    std::string_view try_complete(std::string_view inputbuffer);
+    bool update_completions(std::string_view inputbuffer, std::string_view& last);
     void print_luastack(int first, int last, luainspector_logtype logtype);
-    bool try_eval(std::string m_buffcmd, bool addreturn);
+    bool try_eval(std::string_view code, bool addreturn);
+    bool load_command(std::string_view code);
+    void add_watch(std::string_view expr);
+    bool command_running() const { return m_command != nullptr; }
+    void cancel_command();
+    luainspector_command_stats command_stats() const;
+    bool command_gc_cycle(std::uint32_t serial);
+    std::size_t apply_edits(lua_State* L);
+    std::size_t pending_edits() const { return m_edits.size(); }
+
+private:
+    void start_command();
+    void resume_command();
+    void end_command();
+    void begin_snapshot(lua_State* L);
+    void collect_table_row(lua_State* L, int anchor, std::uint32_t parent);
+    void jump_to_first(const inspect_table_row& row);
+    bool reuse_table_rows(lua_State* L, int anchor, int old_anchor, std::uint32_t parent);
+    void end_table_walk(std::uint32_t row);
+    void track_row(inspect_table_row& row);
+    void add_sequence_rows(std::uint32_t parent, lua_Integer n);
+    bool walk_page(lua_State* L, int anchor, int budget_us, std::chrono::steady_clock::time_point deadline, unsigned& visited);
+    bool walk_summary(lua_State* L, int budget_us, std::chrono::steady_clock::time_point deadline, unsigned& visited);
+    static std::uint64_t page_id(std::uint64_t table_id, lua_Integer index);
+    void open_pages(const luainspector_search_index& index, std::uint32_t entry, std::unordered_set<std::uint64_t>& open);
+    bool is_row_open(std::uint64_t id) const { return m_open_rows.count(id) || m_search_expanded.count(id); }
+    void begin_search_index(lua_State* L);
+    bool update_index(lua_State* L, const inspect_table_config& cfg);
+    void update_search(lua_State* L, const inspect_table_config& cfg);
+    void jump_to_entry(const luainspector_search_index& index, std::uint32_t entry);
+    void draw_tables(lua_State* L);
+    bool compile_watch(lua_State* L, luainspector_watch& w);
+    void sample_watches(lua_State* L);
+    void draw_watches(lua_State* L);
+    void build_visible_rows(const inspect_table_config& cfg);
+    bool push_row_table(lua_State* L, const inspect_table_row& row);
+    bool push_row_key(lua_State* L, const inspect_table_row& row);
+    luainspector_edit* queue_edit(lua_State* L, const inspect_table_row& row, int table);
+    void draw_table_row(const inspect_table_row& row);
+    void draw_table_row_editor(lua_State* L, const inspect_table_row& row);
+    void draw_memory(lua_State* L);
+    void draw_heap_snapshots(lua_State* L);
+    void draw_retainers(lua_State* L);
+    void open_string_viewer(lua_State* L, int idx, const char* title);
+    void draw_string_viewer(lua_State* L);
+    void draw_profiler(lua_State* L);
+    void draw_profiler_flame(std::uint32_t n, float x, float width, float top, float row_height, double scale);
+    void draw_profiler_tree(std::uint32_t n);
 };
 }  // namespace neko
 
@@ -11,3 +11,10 @@ target("example")
     add_files("imgui_lua_inspector.cpp", "example/main.cpp")
     add_packages("lua", "imgui")
 
+
+target("bench")
+    set_kind("binary")
+    set_default(false)
+    add_headerfiles("imgui_lua_inspector.hpp")
+    add_files("imgui_lua_inspector.cpp", "bench/main.cpp")
+    add_packages("lua", "imgui")